@@ -0,0 +1,1164 @@
+/* * bench ***/
+
+// bench.c runs the editor's hot paths without a terminal and reports how
+// long each operation takes. it includes main.c directly, so every function
+// and the global E are available here. build and run it with `make bench`.
+//
+// usage: ./bench [-n rows] [-o file] [-b file] [-t factor] [-s steps] [-r seed]
+//   -n rows    number of rows in the generated corpora (default 200000)
+//   -o file    also write one JSON object per benchmark to file
+//   -b file    compare ns/op with a file written by -o
+//   -t factor  how much slower than the baseline counts as a regression
+//              (default 1.5)
+//   -s steps   run the random edit stress test instead, see the stress section
+//   -r seed    seed for the stress test
+
+#define _GNU_SOURCE
+
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+// features.h has already defined _DEFAULT_SOURCE by now, let main.c define it
+// again without a redefinition warning. _GNU_SOURCE has to be set here, the
+// headers are only configured once.
+#undef _DEFAULT_SOURCE
+
+/** allocation counting */
+
+// every malloc(), calloc(), realloc() and strdup() in main.c goes through
+// these, so each benchmark can report how much it allocated per operation.
+
+struct benchAllocs {
+  size_t count;
+  size_t bytes;
+};
+
+struct benchAllocs benchAllocs;
+
+void *benchMalloc(size_t n) {
+  benchAllocs.count++;
+  benchAllocs.bytes += n;
+  return malloc(n);
+}
+
+void *benchCalloc(size_t nmemb, size_t n) {
+  benchAllocs.count++;
+  benchAllocs.bytes += nmemb * n;
+  return calloc(nmemb, n);
+}
+
+// benchRealloc() only counts what a block grows by, so a buffer that doubles
+// is counted about once in total rather than at every step.
+void *benchRealloc(void *p, size_t n) {
+  size_t old = p ? malloc_usable_size(p) : 0;
+  benchAllocs.count++;
+  benchAllocs.bytes += n > old ? n - old : 0;
+  return realloc(p, n);
+}
+
+char *benchStrdup(const char *s) {
+  benchAllocs.count++;
+  benchAllocs.bytes += strlen(s) + 1;
+  return strdup(s);
+}
+
+#define malloc(n) benchMalloc(n)
+#define calloc(m, n) benchCalloc(m, n)
+#define realloc(p, n) benchRealloc(p, n)
+#define strdup(s) benchStrdup(s)
+
+#define TEXT_EDITOR_NO_MAIN
+#include "main.c"
+
+#undef malloc
+#undef calloc
+#undef realloc
+#undef strdup
+
+/** corpora */
+
+uint64_t bench_rng = 88172645463325252ULL;
+
+// benchRand() is xorshift64, so the corpora are the same on every run.
+uint64_t benchRand() {
+  bench_rng ^= bench_rng << 13;
+  bench_rng ^= bench_rng >> 7;
+  bench_rng ^= bench_rng << 17;
+  return bench_rng;
+}
+
+char *bench_words[] = {"int",    "return", "if",     "while", "struct",
+                       "char",   "static", "buffer", "len",   "row",
+                       "editor", "size_t", "void",   "for",   "unsigned"};
+
+#define BENCH_WORDS (sizeof(bench_words) / sizeof(bench_words[0]))
+
+// benchCodeLine() writes a C-like line with keywords, numbers, strings and
+// comments into buf and returns its length.
+int benchCodeLine(char *buf, int64_t i) {
+  int len = 0;
+  int indent = benchRand() % 4;
+  for (int j = 0; j < indent; j++)
+    buf[len++] = '\t';
+  int words = 2 + benchRand() % 8;
+  for (int j = 0; j < words; j++) {
+    len += sprintf(&buf[len], "%s ", bench_words[benchRand() % BENCH_WORDS]);
+    switch (benchRand() % 8) {
+    case 0:
+      len += sprintf(&buf[len], "%d ", (int)(benchRand() % 100000));
+      break;
+    case 1:
+      len += sprintf(&buf[len], "\"str %d\" ", (int)(benchRand() % 100));
+      break;
+    case 2:
+      len += sprintf(&buf[len], "= ");
+      break;
+    }
+  }
+  // a rare word for the find benchmarks.
+  if (i % 1000 == 999)
+    len += sprintf(&buf[len], "needle_%" PRId64 " ", i);
+  if (benchRand() % 5 == 0)
+    len += sprintf(&buf[len], "// comment");
+  else if (benchRand() % 50 == 0)
+    len += sprintf(&buf[len], "/* open");
+  else if (benchRand() % 50 == 0)
+    len += sprintf(&buf[len], "close */");
+  return len;
+}
+
+// benchLogLine() writes a log-like line, plain ASCII without tabs.
+int benchLogLine(char *buf, int64_t i) {
+  return sprintf(buf, "2024-01-01T00:00:%02d.%06d INFO worker-%d request %" PRId64
+                      " took %dms status=%d",
+                 (int)(i % 60), (int)(benchRand() % 1000000),
+                 (int)(benchRand() % 16), i, (int)(benchRand() % 500),
+                 (int)(200 + benchRand() % 4 * 100));
+}
+
+// benchLoad() replaces the document with n generated rows.
+void benchLoad(int64_t n, int code) {
+  char buf[512];
+  editorFreeRows();
+  editorInitState();
+  E.screenrows = 40;
+  E.screencols = 120;
+  E.syntax = code ? &HLDB[0] : NULL;
+  for (int64_t i = 0; i < n; i++) {
+    int len = code ? benchCodeLine(buf, i) : benchLogLine(buf, i);
+    editorInsertRow(E.numrows, buf, len);
+  }
+  E.dirty = 0;
+}
+
+size_t benchDocBytes() {
+  size_t total = 0;
+  for (int64_t j = 0; j < E.numrows; j++)
+    total += E.row[j].size + 1;
+  return total;
+}
+
+/** timing and reporting */
+
+struct benchResult {
+  const char *name;
+  int64_t ops;
+  double ns;       // total time.
+  size_t allocs;   // number of allocations.
+  size_t bytes;    // bytes allocated.
+  double mb;       // megabytes processed, 0 when throughput does not apply.
+  double extra;    // benchmark specific value, see extra_name.
+  const char *extra_name;
+};
+
+// -b file loads the JSON lines of an earlier run written with -o. a
+// benchmark whose ns/op is more than bench_threshold times its baseline is
+// reported as a regression, and bench exits with status 1.
+
+struct benchBaseline {
+  char name[64];
+  double ns_per_op;
+};
+
+struct benchBaseline *bench_baseline = NULL;
+int bench_nbaseline = 0;
+double bench_threshold = 1.5;
+int bench_regressions = 0;
+
+void benchLoadBaseline(const char *path) {
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL)
+    die("fopen");
+  char line[1024];
+  while (fgets(line, sizeof(line), fp)) {
+    char *name = strstr(line, "\"name\":\"");
+    char *ns = strstr(line, "\"ns_per_op\":");
+    if (name == NULL || ns == NULL)
+      continue;
+    bench_baseline = realloc(bench_baseline, (bench_nbaseline + 1) *
+                                                 sizeof(struct benchBaseline));
+    struct benchBaseline *b = &bench_baseline[bench_nbaseline++];
+    name += strlen("\"name\":\"");
+    size_t len = strcspn(name, "\"");
+    if (len >= sizeof(b->name))
+      len = sizeof(b->name) - 1;
+    memcpy(b->name, name, len);
+    b->name[len] = '\0';
+    b->ns_per_op = atof(ns + strlen("\"ns_per_op\":"));
+  }
+  fclose(fp);
+}
+
+void benchCompare(const char *name, double ns_per_op) {
+  for (int i = 0; i < bench_nbaseline; i++) {
+    struct benchBaseline *b = &bench_baseline[i];
+    if (strcmp(b->name, name) || b->ns_per_op <= 0)
+      continue;
+    double ratio = ns_per_op / b->ns_per_op;
+    printf("  %.2fx", ratio);
+    if (ratio > bench_threshold) {
+      printf(" REGRESSION");
+      bench_regressions++;
+    }
+    return;
+  }
+}
+
+struct timespec bench_start;
+struct benchAllocs bench_allocs_start;
+FILE *bench_json = NULL;
+
+void benchBegin() {
+  bench_allocs_start = benchAllocs;
+  clock_gettime(CLOCK_MONOTONIC, &bench_start);
+}
+
+void benchEnd(struct benchResult *r) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  r->ns = (end.tv_sec - bench_start.tv_sec) * 1e9 +
+          (end.tv_nsec - bench_start.tv_nsec);
+  r->allocs = benchAllocs.count - bench_allocs_start.count;
+  r->bytes = benchAllocs.bytes - bench_allocs_start.bytes;
+}
+
+void benchReport(struct benchResult *r) {
+  double ops = r->ops ? r->ops : 1;
+  double mbps = r->mb ? r->mb / (r->ns / 1e9) : 0;
+  printf("%-22s %10" PRId64 " %12.1f %10.1f %8.2f", r->name, r->ops,
+         r->ns / ops, r->bytes / ops, r->allocs / ops);
+  if (mbps)
+    printf(" %9.1f", mbps);
+  else
+    printf(" %9s", "-");
+  if (r->extra_name)
+    printf("  %s=%.1f", r->extra_name, r->extra);
+  benchCompare(r->name, r->ns / ops);
+  printf("\n");
+
+  if (bench_json) {
+    fprintf(bench_json,
+            "{\"name\":\"%s\",\"version\":\"%s\",\"ops\":%" PRId64
+            ",\"ns_per_op\":%.1f,\"bytes_per_op\":%.1f,\"allocs_per_op\":%.2f,"
+            "\"mb_per_s\":%.1f",
+            r->name, TEXT_EDITOR_VERSION, r->ops, r->ns / ops, r->bytes / ops,
+            r->allocs / ops, mbps);
+    if (r->extra_name)
+      fprintf(bench_json, ",\"%s\":%.1f", r->extra_name, r->extra);
+    fprintf(bench_json, "}\n");
+  }
+}
+
+/** benchmarks */
+
+void benchInsertRow(int64_t n, int code) {
+  struct benchResult r = {.name = code ? "insert_row/code" : "insert_row/log",
+                          .ops = n};
+  editorFreeRows();
+  benchBegin();
+  benchLoad(n, code);
+  benchEnd(&r);
+  r.mb = benchDocBytes() / 1e6;
+  benchReport(&r);
+}
+
+void benchRowInsertChar(int64_t n) {
+  struct benchResult r = {.name = "row_insert_char", .ops = n};
+  benchLoad(n / 10, 1);
+  benchBegin();
+  for (int64_t i = 0; i < n; i++) {
+    erow *row = &E.row[benchRand() % E.numrows];
+    editorRowInsertChar(row, row->size / 2, 'a' + i % 26);
+  }
+  benchEnd(&r);
+  benchReport(&r);
+}
+
+void benchUpdateSyntax(int64_t n) {
+  struct benchResult r = {.name = "update_syntax", .ops = 0};
+  benchLoad(n, 1);
+  size_t bytes = benchDocBytes();
+  benchBegin();
+  for (int pass = 0; pass < 3; pass++) {
+    for (int64_t j = 0; j < E.numrows; j++)
+      editorUpdateSyntax(&E.row[j]);
+  }
+  benchEnd(&r);
+  r.ops = E.numrows * 3;
+  r.mb = bytes * 3 / 1e6;
+  benchReport(&r);
+}
+
+void benchFind(int64_t n) {
+  struct benchResult miss = {.name = "find/miss", .ops = 20};
+  struct benchResult next = {.name = "find/next", .ops = 200};
+  benchLoad(n, 1);
+  size_t bytes = benchDocBytes();
+
+  // a query that is not in the document scans every row.
+  benchBegin();
+  for (int64_t i = 0; i < miss.ops; i++)
+    editorFindCallBack("no such text anywhere", 'x');
+  benchEnd(&miss);
+  miss.mb = bytes * miss.ops / 1e6;
+  benchReport(&miss);
+
+  // "needle_" is on every 1000th row, arrow down jumps to the next one.
+  editorFindCallBack("needle_", 'x');
+  benchBegin();
+  for (int64_t i = 0; i < next.ops; i++)
+    editorFindCallBack("needle_", Arrow_Down);
+  benchEnd(&next);
+  editorFindCallBack("needle_", '\x1b');
+  benchReport(&next);
+}
+
+void benchSave(int64_t n) {
+  struct benchResult str = {.name = "rows_string", .ops = 10};
+  struct benchResult save = {.name = "save", .ops = 5};
+  benchLoad(n, 0);
+  size_t bytes = benchDocBytes();
+
+  benchBegin();
+  for (int64_t i = 0; i < str.ops; i++) {
+    size_t len;
+    free(editorRowsString(&len));
+  }
+  benchEnd(&str);
+  str.mb = bytes * str.ops / 1e6;
+  benchReport(&str);
+
+  char path[] = "/tmp/text_editor-bench-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd == -1)
+    die("mkstemp");
+  close(fd);
+  free(E.filename);
+  E.filename = strdup(path);
+  benchBegin();
+  for (int64_t i = 0; i < save.ops; i++)
+    editorSave();
+  benchEnd(&save);
+  save.mb = bytes * save.ops / 1e6;
+  unlink(path);
+  free(E.filename);
+  E.filename = NULL;
+  benchReport(&save);
+}
+
+void benchReplace(int64_t n) {
+  struct benchResult all = {.name = "replace_all"};
+  struct benchResult undo = {.name = "replace_undo"};
+  benchLoad(n, 1);
+  size_t bytes = benchDocBytes();
+
+  // "row" is one of the generated words, so most rows have a match.
+  benchBegin();
+  all.ops = editorReplaceAll("row", "line");
+  benchEnd(&all);
+  all.mb = bytes / 1e6;
+  all.extra = E.undo.nrows;
+  all.extra_name = "rows";
+  benchReport(&all);
+
+  benchBegin();
+  editorUndoApply();
+  benchEnd(&undo);
+  undo.ops = E.undo.count;
+  undo.mb = benchDocBytes() / 1e6;
+  benchReport(&undo);
+}
+
+void benchDrawRows(int64_t n) {
+  struct benchResult r = {.name = "draw_rows", .ops = 2000};
+  benchLoad(n, 1);
+  size_t emitted = 0;
+
+  benchBegin();
+  for (int64_t i = 0; i < r.ops; i++) {
+    struct abuf ab = ABUF_INIT;
+    E.rowoff = benchRand() % (E.numrows - E.screenrows);
+    editorDrawRows(&ab);
+    emitted += ab.len;
+    abFree(&ab);
+  }
+  benchEnd(&r);
+  r.mb = emitted / 1e6;
+  r.extra = (double)emitted / r.ops;
+  r.extra_name = "bytes_per_frame";
+  benchReport(&r);
+}
+
+// every 20th row defines a function and every 100th a struct, the rest are
+// the usual code rows.
+void benchSymbols(int64_t n) {
+  struct benchResult index = {.name = "symbol_index"};
+  struct benchResult match = {.name = "symbol_match", .ops = 1000};
+  const char *queries[] = {"benchfn12", "bt_77", "bfn", "zzz", "b_type_9"};
+  char buf[512];
+  benchLoad(0, 1);
+  for (int64_t i = 0; i < n; i++) {
+    int len = i % 100 == 0 ? sprintf(buf, "struct bench_type_%" PRId64 " {", i)
+              : i % 20 == 0
+                  ? sprintf(buf, "static int bench_fn_%" PRId64 "(int a) {", i)
+                  : benchCodeLine(buf, i);
+    editorInsertRow(E.numrows, buf, len);
+  }
+  size_t bytes = benchDocBytes();
+
+  benchBegin();
+  symbolWork(0);
+  benchEnd(&index);
+  index.ops = E.numrows;
+  index.mb = bytes / 1e6;
+  index.extra = E.sym.n;
+  index.extra_name = "symbols";
+  benchReport(&index);
+
+  int64_t best[SYMBOL_MATCHES];
+  int found = 0;
+  benchBegin();
+  for (int64_t i = 0; i < match.ops; i++)
+    found += symbolMatch(queries[i % 5], best);
+  benchEnd(&match);
+  match.extra = (double)found / match.ops;
+  match.extra_name = "matches";
+  benchReport(&match);
+}
+
+// word_index counts every word of a fresh document, word_edit is
+// row_insert_char with the counts kept up to date and word_complete looks
+// up the three best completions of common prefixes.
+void benchWords(int64_t n) {
+  struct benchResult index = {.name = "word_index"};
+  struct benchResult edit = {.name = "word_edit", .ops = n};
+  struct benchResult complete = {.name = "word_complete", .ops = 100000};
+  const char *prefixes[] = {"st", "re", "edi", "un", "si", "needle_1"};
+  char cand[WORD_CANDIDATES][WORD_MAX + 1];
+  benchLoad(n, 1);
+  size_t bytes = benchDocBytes();
+
+  benchBegin();
+  E.words.on = 1;
+  wordsWork(0);
+  benchEnd(&index);
+  index.ops = E.numrows;
+  index.mb = bytes / 1e6;
+  index.extra = E.words.nnode;
+  index.extra_name = "nodes";
+  benchReport(&index);
+
+  benchBegin();
+  for (int64_t i = 0; i < n; i++) {
+    erow *row = &E.row[benchRand() % E.numrows];
+    editorRowInsertChar(row, row->size / 2, 'a' + i % 26);
+  }
+  benchEnd(&edit);
+  benchReport(&edit);
+
+  int found = 0;
+  benchBegin();
+  for (int64_t i = 0; i < complete.ops; i++) {
+    const char *p = prefixes[i % 6];
+    found += wordsComplete(p, strlen(p), cand, 3);
+  }
+  benchEnd(&complete);
+  complete.extra = (double)found / complete.ops;
+  complete.extra_name = "candidates";
+  benchReport(&complete);
+}
+
+/** stress */
+
+// -s steps makes random edits to a small document with the editor
+// operations, and the same edits to a model that keeps each line as a NUL
+// terminated string. after every step the rows are compared with the model.
+// the render, colmarks and highlighting of the rows around the cursor, and
+// of all rows every STRESS_FULL_CHECK steps, are worked out again from the
+// model and compared with what the editor kept up to date as it went. the
+// first difference is reported with the step and seed, and bench exits with
+// status 1.
+
+#define STRESS_FULL_CHECK 256
+#define STRESS_MAX_ROWS 200
+
+struct stressLine {
+  char *s;
+  size_t len;
+};
+
+struct stressModel {
+  struct stressLine *lines;
+  int64_t n, cap;
+  int64_t cy;
+  size_t cx;
+};
+
+struct stressModel stress;
+int64_t stress_step;
+uint64_t stress_seed;
+const char *stress_op = "load";
+
+void stressFail(const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  fprintf(stderr, "stress: step %" PRId64 " (%s, seed %" PRIu64 "): ",
+          stress_step, stress_op, stress_seed);
+  vfprintf(stderr, fmt, ap);
+  fprintf(stderr, "\n");
+  va_end(ap);
+  exit(1);
+}
+
+void stressInsertLine(int64_t at, const char *s, size_t len) {
+  if (stress.n == stress.cap) {
+    stress.cap = stress.cap ? stress.cap * 2 : 64;
+    stress.lines = realloc(stress.lines, stress.cap * sizeof(struct stressLine));
+  }
+  memmove(&stress.lines[at + 1], &stress.lines[at],
+          (stress.n - at) * sizeof(struct stressLine));
+  stress.lines[at].s = malloc(len + 1);
+  memcpy(stress.lines[at].s, s, len);
+  stress.lines[at].s[len] = '\0';
+  stress.lines[at].len = len;
+  stress.n++;
+}
+
+void stressDelLine(int64_t at) {
+  free(stress.lines[at].s);
+  memmove(&stress.lines[at], &stress.lines[at + 1],
+          (stress.n - at - 1) * sizeof(struct stressLine));
+  stress.n--;
+}
+
+// stressSplice() replaces len bytes at 'at' in line l with s.
+void stressSplice(struct stressLine *l, size_t at, size_t len, const char *s,
+                  size_t slen) {
+  char *out = malloc(l->len - len + slen + 1);
+  memcpy(out, l->s, at);
+  memcpy(out + at, s, slen);
+  memcpy(out + at + slen, l->s + at + len, l->len - at - len + 1);
+  free(l->s);
+  l->s = out;
+  l->len = l->len - len + slen;
+}
+
+// the model steps over characters the simple way: a valid UTF-8 sequence is
+// one character, any other byte is a character on its own.
+size_t stressNext(struct stressLine *l, size_t cx) {
+  uint32_t cp;
+  int len = utf8Decode(&l->s[cx], l->len - cx, &cp);
+  return cx + (len ? len : 1);
+}
+
+size_t stressPrev(struct stressLine *l, size_t cx) {
+  uint32_t cp;
+  for (size_t k = 2; k <= 4 && k <= cx; k++) {
+    if ((size_t)utf8Decode(&l->s[cx - k], l->len - (cx - k), &cp) == k)
+      return cx - k;
+  }
+  return cx - 1;
+}
+
+/* model operations, the same as editorInsertChars(), editorInsertNewline()
+   and editorDelChar(). */
+
+void stressInsertChar(int c) {
+  char ch = c;
+  if (stress.cy == stress.n)
+    stressInsertLine(stress.n, "", 0);
+  stressSplice(&stress.lines[stress.cy], stress.cx, 0, &ch, 1);
+  stress.cx++;
+}
+
+void stressNewline() {
+  if (stress.cy == stress.n) {
+    stressInsertLine(stress.cy, "", 0);
+  } else {
+    struct stressLine *l = &stress.lines[stress.cy];
+    stressInsertLine(stress.cy + 1, l->s + stress.cx, l->len - stress.cx);
+    stress.lines[stress.cy].len = stress.cx;
+    stress.lines[stress.cy].s[stress.cx] = '\0';
+  }
+  stress.cy++;
+  stress.cx = 0;
+}
+
+void stressDelChar() {
+  if (stress.cy == stress.n || (stress.cx == 0 && stress.cy == 0))
+    return;
+  struct stressLine *l = &stress.lines[stress.cy];
+  if (stress.cx > 0) {
+    size_t p = stressPrev(l, stress.cx);
+    stressSplice(l, p, stressNext(l, p) - p, "", 0);
+    stress.cx = p;
+  } else {
+    struct stressLine *prev = &stress.lines[stress.cy - 1];
+    stress.cx = prev->len;
+    stressSplice(prev, prev->len, 0, l->s, l->len);
+    stressDelLine(stress.cy);
+    stress.cy--;
+  }
+}
+
+void stressReplaceAll(const char *query, const char *rep) {
+  size_t qlen = strlen(query), rlen = strlen(rep);
+  for (int64_t j = 0; j < stress.n; j++) {
+    struct stressLine *l = &stress.lines[j];
+    for (size_t i = 0; i + qlen <= l->len;) {
+      if (memcmp(&l->s[i], query, qlen) == 0) {
+        stressSplice(l, i, qlen, rep, rlen);
+        i += rlen;
+      } else {
+        i++;
+      }
+    }
+  }
+}
+
+// stressLayout() lays out a line the way the render is described: tabs go
+// to the next tab stop, valid characters are copied and take their width,
+// other bytes become '?'. it returns the render in a static buffer and sets
+// *rx to the column of byte cx.
+char *stressLayout(struct stressLine *l, size_t *rsize, size_t cx,
+                   size_t *rx) {
+  static char *buf = NULL;
+  static size_t cap = 0;
+  if (l->len * TEXT_EDITOR_TAB_STOP + 1 > cap) {
+    cap = l->len * TEXT_EDITOR_TAB_STOP + 1;
+    buf = realloc(buf, cap);
+  }
+  size_t rb = 0, col = 0;
+  *rx = 0;
+  for (size_t j = 0; j < l->len;) {
+    if (j == cx)
+      *rx = col;
+    uint32_t cp;
+    int len = utf8Decode(&l->s[j], l->len - j, &cp);
+    if (l->s[j] == '\t') {
+      do {
+        buf[rb++] = ' ';
+        col++;
+      } while (col % TEXT_EDITOR_TAB_STOP);
+      j++;
+    } else if (len == 0) {
+      buf[rb++] = '?';
+      col++;
+      j++;
+    } else {
+      memcpy(&buf[rb], &l->s[j], len);
+      rb += len;
+      col += editorCharWidth(cp);
+      j += len;
+    }
+  }
+  if (cx >= l->len)
+    *rx = col;
+  buf[rb] = '\0';
+  *rsize = rb;
+  return buf;
+}
+
+// stressCheckRow() checks row j in depth, given whether the row above ends
+// in an open comment. it returns whether row j does.
+int stressCheckRow(int64_t j, int open) {
+  erow *row = &E.row[j];
+  struct stressLine *l = &stress.lines[j];
+
+  // a character boundary to check the column mapping at.
+  size_t cx = 0, target = benchRand() % (l->len + 1);
+  while (cx < target)
+    cx = stressNext(l, cx);
+  size_t rsize, rx;
+  char *render = stressLayout(l, &rsize, cx, &rx);
+
+  if (row->rsize != rsize || memcmp(row->render, render, rsize) ||
+      row->render[rsize] != '\0')
+    stressFail("row %" PRId64 ": render differs", j);
+  if (row->render_shared && row->render != row->chars)
+    stressFail("row %" PRId64 ": shared render is not chars", j);
+  if (editorRowsCxToRx(row, cx) != rx)
+    stressFail("row %" PRId64 ": cx %zu maps to rx %zu, want %zu", j, cx,
+               editorRowsCxToRx(row, cx), rx);
+  // zero width characters share their column with the next character, so
+  // only a character that takes up columns can be found by its column.
+  uint32_t cp = 0;
+  int zero = cx < l->len && utf8Decode(&l->s[cx], l->len - cx, &cp) &&
+             editorCharWidth(cp) == 0;
+  if (!zero && editorRowRxToCx(row, rx) != cx)
+    stressFail("row %" PRId64 ": rx %zu maps to cx %zu, want %zu", j, rx,
+               editorRowRxToCx(row, rx), cx);
+  if ((row->lr != NULL) != (row->size >= LONG_ROW_SIZE))
+    stressFail("row %" PRId64 ": long row state is wrong", j);
+
+  if (E.syntax == NULL)
+    return 0;
+
+  // long rows are highlighted on chars, the others on render.
+  static unsigned char *hl = NULL, *have = NULL;
+  static size_t cap = 0;
+  size_t len = row->lr ? l->len : rsize;
+  if (len + HL_SLACK > cap) {
+    cap = len + HL_SLACK;
+    hl = realloc(hl, cap);
+    have = realloc(have, cap);
+  }
+  struct hlState st = {0, open, 1, 0, HL_NORMAL};
+  editorHighlight(row->lr ? l->s : render, len, len, &st, hl, NULL);
+
+  if (row->lr) {
+    if (row->nhl != 0)
+      stressFail("row %" PRId64 ": long row has spans", j);
+    if (editorRowOpenComment(j) != st.in_comment)
+      stressFail("row %" PRId64 ": long row comment state is wrong", j);
+    return st.in_comment;
+  }
+
+  size_t at = 0;
+  for (uint32_t i = 0; i < row->nhl; i++) {
+    if (at + row->hl[i].len > rsize)
+      stressFail("row %" PRId64 ": spans are longer than render", j);
+    memset(&have[at], row->hl[i].hl, row->hl[i].len);
+    at += row->hl[i].len;
+  }
+  memset(&have[at], HL_NORMAL, rsize - at);
+  if (memcmp(have, hl, rsize))
+    stressFail("row %" PRId64 ": highlighting differs", j);
+  if (row->hl_open_comment != st.in_comment)
+    stressFail("row %" PRId64 ": hl_open_comment is %d, want %d", j,
+               row->hl_open_comment, st.in_comment);
+  return st.in_comment;
+}
+
+// stressCheckSymbols() compares the symbol index that the edits kept up to
+// date with one made from scratch. rows added past the indexed ones are
+// indexed first, as the idle time would.
+void stressCheckSymbols() {
+  struct editorSymbols *s = &E.sym;
+  symbolWork(0);
+  int64_t n = s->n;
+  struct editorSymbol *kept = malloc((n + 1) * sizeof(struct editorSymbol));
+  char **names = malloc((n + 1) * sizeof(char *));
+  for (int64_t j = 0; j < n; j++) {
+    kept[j] = s->sym[j];
+    names[j] = strndup(&s->names[s->sym[j].name], s->sym[j].len);
+  }
+  symbolReset();
+  symbolWork(0);
+  if (s->n != n)
+    stressFail("%" PRId64 " symbols, want %" PRId64, n, s->n);
+  for (int64_t j = 0; j < n; j++) {
+    struct editorSymbol *want = &s->sym[j];
+    if (kept[j].row != want->row || kept[j].off != want->off ||
+        kept[j].len != want->len || kept[j].kind != want->kind ||
+        kept[j].mask != want->mask ||
+        memcmp(names[j], &s->names[want->name], want->len))
+      stressFail("symbol %" PRId64 " is %s on row %" PRId64 ", want %.*s on "
+                 "row %" PRId64, j, names[j], kept[j].row, (int)want->len,
+                 &s->names[want->name], want->row);
+    free(names[j]);
+  }
+  free(kept);
+  free(names);
+}
+
+// stressCheckWords() checks that every node's max is the highest count
+// under it, and that taking the words of every row out of the counts, as
+// they are now, leaves nothing. then they are counted again.
+void stressCheckWords() {
+  struct editorWords *w = &E.words;
+  wordsWork(0);
+  for (int32_t i = 0; i < w->nnode; i++) {
+    uint32_t max = w->node[i].count;
+    for (int32_t k = w->node[i].child; k != -1; k = w->node[k].sibling)
+      max = w->node[k].max > max ? w->node[k].max : max;
+    if (w->node[i].max != max)
+      stressFail("word node %d has max %u, want %u", (int)i, w->node[i].max,
+                 max);
+  }
+  for (int64_t j = 0; j < E.numrows; j++) {
+    if (!E.row[j].words_counted)
+      stressFail("row %" PRId64 ": words not counted", j);
+    wordsForget(&E.row[j]);
+  }
+  if (w->total != 0)
+    stressFail("%" PRId64 " words left over", w->total);
+  int32_t nfree = 0;
+  for (int32_t i = w->nfree; i != -1; i = w->node[i].sibling)
+    nfree++;
+  if (w->nnode > 0 && nfree != w->nnode - 1)
+    stressFail("%d word nodes not freed", (int)(w->nnode - 1 - nfree));
+  w->scan = 0;
+  wordsWork(0);
+}
+
+// stressCheck() compares every row with the model. full checks every row in
+// depth with the comment state carried from the first row, otherwise only
+// the rows around the cursor are, starting from the state of the row above.
+void stressCheck(int full) {
+  if (E.numrows != stress.n)
+    stressFail("%" PRId64 " rows, want %" PRId64, E.numrows, stress.n);
+  if (E.cy != stress.cy || E.cx != stress.cx)
+    stressFail("cursor at %" PRId64 ",%zu, want %" PRId64 ",%zu", E.cy,
+               (size_t)E.cx, stress.cy, stress.cx);
+  for (int64_t j = 0; j < E.numrows; j++) {
+    erow *row = &E.row[j];
+    struct stressLine *l = &stress.lines[j];
+    if (row->idx != j)
+      stressFail("row %" PRId64 " has idx %" PRId64, j, row->idx);
+    if (row->size != l->len || memcmp(row->chars, l->s, l->len) ||
+        row->chars[row->size] != '\0')
+      stressFail("row %" PRId64 ": chars differ", j);
+  }
+
+  if (full) {
+    int open = 0;
+    for (int64_t j = 0; j < E.numrows; j++)
+      open = stressCheckRow(j, open);
+    stressCheckSymbols();
+    stressCheckWords();
+    return;
+  }
+  for (int64_t j = stress.cy - 1; j <= stress.cy + 1; j++) {
+    if (j < 0 || j >= E.numrows)
+      continue;
+    // checking a long row means laying out and highlighting all of it.
+    if (E.row[j].lr && stress_step % 16)
+      continue;
+    stressCheckRow(j, editorRowOpenComment(j - 1));
+  }
+}
+
+// stressSnapshot() copies the model, so an undo can be checked against it.
+struct stressLine *stressSnapshot(int64_t *n) {
+  struct stressLine *copy = malloc((stress.n + 1) * sizeof(struct stressLine));
+  for (int64_t j = 0; j < stress.n; j++) {
+    copy[j].len = stress.lines[j].len;
+    copy[j].s = malloc(copy[j].len + 1);
+    memcpy(copy[j].s, stress.lines[j].s, copy[j].len + 1);
+  }
+  *n = stress.n;
+  return copy;
+}
+
+void stressRestore(struct stressLine *lines, int64_t n) {
+  while (stress.n)
+    stressDelLine(stress.n - 1);
+  for (int64_t j = 0; j < n; j++)
+    stressInsertLine(j, lines[j].s, lines[j].len);
+}
+
+void stressFreeSnapshot(struct stressLine *lines, int64_t n) {
+  for (int64_t j = 0; j < n; j++)
+    free(lines[j].s);
+  free(lines);
+}
+
+// snippets are typed a byte at a time, so multibyte characters go through
+// invalid states on the way, like they do when typed into the terminal.
+const char *stress_snippets[] = {
+    "a",  "x",  " ", "\t", "0",  "7",  "/*", "*/", "//", "/", "*",
+    "\"", "\\", "'", "int", "if", "é",  "中", "😀", "e\xcc\x81", "\xff",
+    "\x80", "{", "}", ";", "return ", "struct s ", "(", "#define m "};
+
+const char *stress_replace[] = {"int", "/*", "a", "é", "\t", "*/", "x"};
+const char *stress_with[] = {"", "long", "*/", "中", "x\ty", "/*", "aa"};
+
+#define STRESS_SNIPPETS (sizeof(stress_snippets) / sizeof(stress_snippets[0]))
+#define STRESS_REPLACE (sizeof(stress_replace) / sizeof(stress_replace[0]))
+#define STRESS_WITH (sizeof(stress_with) / sizeof(stress_with[0]))
+
+int64_t stressLongLine() {
+  for (int64_t j = 0; j < stress.n; j++) {
+    if (stress.lines[j].len >= LONG_ROW_SIZE)
+      return j;
+  }
+  return -1;
+}
+
+// stressMove() puts the cursor on a random character boundary, half of the
+// time in the long row when there is one.
+void stressMove() {
+  int64_t lj = stressLongLine();
+  stress.cy = lj >= 0 && benchRand() % 2 ? lj : (int64_t)(benchRand() % (stress.n + 1));
+  stress.cx = 0;
+  if (stress.cy < stress.n) {
+    struct stressLine *l = &stress.lines[stress.cy];
+    size_t target = benchRand() % (l->len + 1);
+    while (stress.cx < target)
+      stress.cx = stressNext(l, stress.cx);
+  }
+  E.cy = stress.cy;
+  E.cx = stress.cx;
+}
+
+// stressReplace() replaces all of one string with another, then undoes and
+// redoes it, checking after each.
+void stressReplace() {
+  const char *query = stress_replace[benchRand() % STRESS_REPLACE];
+  const char *rep = stress_with[benchRand() % STRESS_WITH];
+  int64_t before_n, after_n;
+  struct stressLine *before = stressSnapshot(&before_n);
+
+  stress_op = "replace all";
+  editorReplaceAll(query, rep);
+  stressReplaceAll(query, rep);
+  E.cy = E.cx = stress.cy = stress.cx = 0;
+  stressCheck(1);
+  struct stressLine *after = stressSnapshot(&after_n);
+
+  stress_op = "undo";
+  editorUndoApply();
+  stressRestore(before, before_n);
+  stressCheck(1);
+  stress_op = "redo";
+  editorUndoApply();
+  stressRestore(after, after_n);
+  stressCheck(1);
+  editorUndoFree();
+
+  stressFreeSnapshot(before, before_n);
+  stressFreeSnapshot(after, after_n);
+}
+
+// stressLongRow() deletes the long row there is, or now and then inserts
+// one, so that the document stays small enough to check after every step.
+// it returns 1 when it inserted a row.
+int stressLongRow() {
+  int64_t j = stressLongLine();
+  if (j >= 0) {
+    stress_op = "delete long row";
+    editorDelRow(j);
+    stressDelLine(j);
+    E.cy = stress.cy = j;
+    E.cx = stress.cx = 0;
+    return 0;
+  }
+  if (benchRand() % 50)
+    return 0;
+  size_t len = LONG_ROW_SIZE + benchRand() % 1024;
+  char *s = malloc(len);
+  for (size_t i = 0; i < len; i++)
+    s[i] = "ab /*\"x1\t*/"[benchRand() % 11];
+  int64_t at = benchRand() % (stress.n + 1);
+  stress_op = "insert long row";
+  editorInsertRow(at, s, len);
+  stressInsertLine(at, s, len);
+  E.cy = stress.cy = at;
+  E.cx = stress.cx = 0;
+  free(s);
+  return 1;
+}
+
+void stressDelRow() {
+  if (stress.n == 0)
+    return;
+  int64_t at = benchRand() % stress.n;
+  stress_op = "delete row";
+  editorDelRow(at);
+  stressDelLine(at);
+  E.cy = stress.cy = at < stress.n ? at : stress.n;
+  E.cx = stress.cx = 0;
+}
+
+// stressLargeFile() opens a file of more than 2^31 bytes in paging mode and
+// checks that byte offsets, jumps and search still find the lines past
+// 2 GB. the file is a hole with a newline every LARGE_LINE bytes followed by
+// a few lines of text, so it only takes a few MB of disk.
+#define LARGE_LINE (1024 * 1024)
+#define LARGE_SIZE ((off_t)1 << 31)
+
+void stressLargeFile() {
+  struct benchResult r = {.name = "large_file", .ops = 1};
+  const char *tail = "tail 0\ntail 1\ntail 2\nneedle_large\ntail 4\n";
+  int64_t holes = LARGE_SIZE / LARGE_LINE, needle = holes + 3;
+  char path[] = "/tmp/text_editor-large-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd == -1)
+    die("mkstemp");
+  stress_op = "large file";
+  for (off_t off = LARGE_LINE - 1; off < LARGE_SIZE; off += LARGE_LINE) {
+    if (pwrite(fd, "\n", 1, off) != 1)
+      die("pwrite");
+  }
+  if (pwrite(fd, tail, strlen(tail), LARGE_SIZE) != (ssize_t)strlen(tail))
+    die("pwrite");
+  close(fd);
+
+  benchBegin();
+  editorOpenView(path, 0);
+  if (E.pager == NULL)
+    stressFail("%s is not paged", path);
+  if (E.numrows != holes + 5)
+    stressFail("%" PRId64 " rows, want %" PRId64, E.numrows, holes + 5);
+  off_t off = E.pager->lineoff[needle];
+  if (off != LARGE_SIZE + 21)
+    stressFail("needle at byte %jd, want %jd", (intmax_t)off,
+               (intmax_t)(LARGE_SIZE + 21));
+
+  size_t col;
+  int64_t at = editorRowAtByte(off + 3, &col);
+  if (at != needle || col != 3)
+    stressFail("byte %jd is row %" PRId64 " col %zu, want %" PRId64 " col 3",
+               (intmax_t)(off + 3), at, col, needle);
+  editorJump(at, col);
+  erow *row = editorRow(E.cy);
+  if (E.cy != needle || E.cx != 3 || row->size != 12 ||
+      memcmp(row->chars, "needle_large", 12) != 0)
+    stressFail("jump to row %" PRId64 " went to row %" PRId64 " col %zu",
+               needle, E.cy, E.cx);
+
+  E.cy = 0;
+  E.cx = 0;
+  editorFindCallBack("needle_large", 'e');
+  if (E.match_row != needle || E.cy != needle)
+    stressFail("search found row %" PRId64 ", want %" PRId64, E.match_row,
+               needle);
+  editorFindCallBack("needle_large", '\x1b');
+  benchEnd(&r);
+  r.mb = (LARGE_SIZE + strlen(tail)) / 1e6;
+  r.extra = E.numrows;
+  r.extra_name = "rows";
+
+  char idx[PATH_MAX + 64];
+  if (pagerCachePath(path, idx, sizeof(idx)) == 0)
+    unlink(idx);
+  unlink(path);
+  editorFreeRows();
+  free(E.filename);
+  E.filename = NULL;
+  benchReport(&r);
+}
+
+void stressRun(int64_t steps) {
+  struct benchResult r = {.name = "stress", .ops = steps};
+  benchLoad(50, 1);
+  for (int64_t j = 0; j < E.numrows; j++)
+    stressInsertLine(j, E.row[j].chars, E.row[j].size);
+  symbolWork(0);
+  E.words.on = 1;
+  // the words are counted from here on, as after the first Ctrl-Y.
+  stressCheck(1);
+
+  int64_t long_rows = 0;
+  benchBegin();
+  for (stress_step = 1; stress_step <= steps; stress_step++) {
+    if (benchRand() % 4 == 0)
+      stressMove();
+    int op = benchRand() % 100;
+    if (stress.n > STRESS_MAX_ROWS)
+      op = 99;
+
+    if (op < 55) {
+      const char *s = stress_snippets[benchRand() % STRESS_SNIPPETS];
+      stress_op = "insert";
+      for (; *s; s++) {
+        editorInsertChars((unsigned char)*s);
+        stressInsertChar((unsigned char)*s);
+      }
+    } else if (op < 70) {
+      stress_op = "newline";
+      editorInsertNewline();
+      stressNewline();
+    } else if (op < 97) {
+      stress_op = "backspace";
+      editorDelChar();
+      stressDelChar();
+    } else if (op == 97) {
+      // replace-all checks the whole document twice, keep it rare.
+      if (benchRand() % 4 == 0)
+        stressReplace();
+    } else if (op == 98) {
+      long_rows += stressLongRow();
+    } else {
+      stressDelRow();
+    }
+    stressCheck(stress_step % STRESS_FULL_CHECK == 0);
+  }
+  benchEnd(&r);
+  stressCheck(1);
+  r.extra = long_rows;
+  r.extra_name = "long_rows";
+  benchReport(&r);
+}
+
+int main(int argc, char *argv[]) {
+  int64_t n = 200000, steps = 0;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+      n = atoll(argv[++i]);
+    } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+      bench_json = fopen(argv[++i], "w");
+      if (bench_json == NULL)
+        die("fopen");
+    } else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+      benchLoadBaseline(argv[++i]);
+    } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+      bench_threshold = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+      steps = atoll(argv[++i]);
+    } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+      uint64_t seed = strtoull(argv[++i], NULL, 10);
+      if (seed)
+        bench_rng = seed; // xorshift must not start at 0.
+    } else {
+      fprintf(stderr,
+              "usage: %s [-n rows] [-o file] [-b file] [-t factor] "
+              "[-s steps] [-r seed]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  if (n < 1000)
+    n = 1000;
+
+  printf("%-22s %10s %12s %10s %8s %9s\n", "benchmark", "ops", "ns/op",
+         "B/op", "allocs", "MB/s");
+  if (steps) {
+    stress_seed = bench_rng;
+    stressLargeFile();
+    stressRun(steps);
+  } else {
+    benchInsertRow(n, 0);
+    benchInsertRow(n, 1);
+    benchRowInsertChar(n);
+    benchUpdateSyntax(n);
+    benchFind(n);
+    benchSave(n);
+    benchReplace(n);
+    benchDrawRows(n);
+    benchSymbols(n);
+    benchWords(n);
+  }
+
+  if (bench_json)
+    fclose(bench_json);
+  if (bench_regressions) {
+    fflush(stdout);
+    fprintf(stderr, "%d benchmarks are more than %.2fx slower than the "
+                    "baseline\n", bench_regressions, bench_threshold);
+    return 1;
+  }
+  return 0;
+}
@@ -7,15 +7,32 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h> // for open() function
+#include <inttypes.h>
+#include <dirent.h>
+#include <limits.h>
+#include <poll.h>
+#include <setjmp.h>
+#include <signal.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 // carrage return is the character that moves the cursor to the beginning of the
 // line.
@@ -35,10 +52,139 @@
 #define EDITOR_QUIT_TIMES 3
 #define HL_HIGHLIGHT_NUMBER (1 << 0)
 #define HL_HIGHLIGHT_STRING (1 << 1)
+
+// files at least this big are opened in paging mode instead of being read
+// into memory, see the paging section below.
+#define TEXT_EDITOR_PAGE_THRESHOLD (256L * 1024 * 1024)
+// render and highlighting kept for background buffers, see the buffers
+// section. --cache-mb changes it.
+#define TEXT_EDITOR_CACHE_MB 256
+// follow mode reads at most this much of a growing file between two frames.
+#define FOLLOW_READ_MAX (64L * 1024 * 1024)
+#define PAGER_CHUNK_SIZE (64 * 1024)
+#define PAGER_CHUNKS 64
+#define PAGER_ROWS 512
+// the line index of a paged file is kept in the cache directory together
+// with the comment state every PAGER_CHECKPOINT_LINES lines, see the paging
+// section. idle time is spent working the comment states out.
+#define PAGER_CHECKPOINT_LINES 256
+#define PAGER_INDEX_OFFSET (64 * 1024)
+#define PAGER_SAMPLES 16
+#define PAGER_SCAN_BUDGET (20 * 1000000)
+// indexes not used for PAGER_CACHE_DAYS are removed from the cache
+// directory, and the least recently used ones while it holds more than
+// PAGER_CACHE_MAX bytes.
+#define PAGER_CACHE_DAYS 30
+#define PAGER_CACHE_MAX (1024L * 1024 * 1024)
+// files with a NUL byte this close to the start are shown in hex, see the
+// hex view section.
+#define HEX_SNIFF 8000
+#define HEX_AUTO -1
+// the diff gutter, see the diff against disk section. a split that takes
+// more than DIFF_MAX_WORK steps settles for a diff that may not be minimal.
+#define DIFF_GUTTER 2
+#define DIFF_MAX_WORK (1000 * 1000)
+#define DIFF_DRAW_BUDGET (2 * 1000000)
+#define DIFF_IDLE_BUDGET (20 * 1000000)
+#define DIFF_ADDED 1
+#define DIFF_CHANGED 2
+#define DIFF_DELETED 4     // lines were deleted just above the row.
+#define DIFF_DELETED_END 8 // lines were deleted after the last row.
+// the symbol index, see the symbols section. arrows go through the
+// SYMBOL_MATCHES best matches.
+#define SYMBOL_ROW_MAX 4
+#define SYMBOL_NAME_MAX 255
+#define SYMBOL_MATCHES 32
+#define SYMBOL_IDLE_BUDGET (20 * 1000000)
+// the word index for completion, see the completion section. words shorter
+// than WORD_MIN or longer than WORD_MAX bytes are not counted.
+#define WORD_MIN 3
+#define WORD_MAX 64
+#define WORD_MAX_NODES (4 * 1024 * 1024)
+#define WORD_CANDIDATES 8
+#define WORD_HEAP 512
+#define WORD_IDLE_BUDGET (20 * 1000000)
+
+// rows this long are highlighted a window at a time, see the long rows
+// section.
+#define LONG_ROW_SIZE (64 * 1024)
+#define LONG_ROW_CHUNK (4 * 1024)
+#define HL_SLACK 64
+
+// row payload allocator, see the row memory section.
+#define SLAB_GRAIN 8
+#define SLAB_FINE_MAX 256
+#define SLAB_MAX_SIZE 4096
+#define SLAB_CLASSES (SLAB_FINE_MAX / SLAB_GRAIN + 4)
+#define SLAB_BLOCK_SIZE (1024 * 1024)
+
+// tracing, see the tracing section. TRACE_BEGIN() and TRACE_END() cost one
+// flag check while tracing is off.
+#define TRACE_EVENTS 65536
+#define TRACE_DEFAULT_FILE "text_editor-trace.json"
+#define TRACE_BEGIN() (E.trace ? editorNow() : 0)
+#define TRACE_END(name, start)                                                 \
+  do {                                                                         \
+    if (E.trace)                                                               \
+      traceEnd(name, start);                                                   \
+  } while (0)
+// editorPromptFlags() flags.
+#define PROMPT_EMPTY 1 // enter also accepts an empty answer.
+
 /** function prototypes **/
+struct erow;
+struct hlState;
+struct erow *editorRow(int64_t at);
+struct erow *editorCachedRow(int64_t at);
+void *rowRealloc(void *p, size_t oldn, size_t n);
 void editorSetStatusMessage(const char *fmt, ...);
 void editorRefreshScreen();
+void editorIdle();
+struct editorFileId;
+int editorFileIdOf(const char *path, struct editorFileId *id);
+void editorWatch();
+void editorCheckDisk();
+void editorFollowSync();
+void editorFollowRead(struct editorFileId *id);
+void editorFollowTrim(int64_t keep);
+int editorStreamWait();
+int editorStreamRead();
+int editorStreamClose(int abort);
+struct editorCompressor;
+struct editorCompressor *editorCompressorOf(int fd);
+struct editorCompressor *editorCompressorFor(const char *filename);
+void editorOpenCompressed(int fd, struct editorCompressor *comp);
+int editorWriteCompressed(struct editorCompressor *comp, int fd, char *buf,
+                          size_t len);
 char *editorPrompt(char *prompt, void (*callback)(char *, int));
+char *editorPromptFlags(char *prompt, void (*callback)(char *, int),
+                        int flags);
+void editorUndoFree();
+void editorClampCursor();
+int64_t editorNow();
+struct hlPass;
+int longRowStep(struct hlPass *pass, size_t at, struct hlState *st);
+void longRowEnd(struct erow *row);
+void longRowSyntax(struct erow *row);
+void traceEnd(const char *name, int64_t start);
+void editorDetach();
+void editorServerIdle();
+struct editorPager;
+int pagerCommentAt(struct editorPager *p, int64_t line);
+struct editorHex;
+int hexIsBinary(int fd);
+struct editorHex *hexOpen(int fd);
+void hexClose(struct editorHex *h);
+void hexSave();
+void editorOpenView(char *filename, int hex);
+int diffWork(int64_t budget);
+void symbolRow(struct erow *row);
+void symbolShift(int64_t at, int64_t del, int64_t ins);
+void symbolReset();
+void symbolWork(int64_t budget);
+void wordsCount(struct erow *row);
+void wordsForget(struct erow *row);
+void wordsWork(int64_t budget);
 
 enum editorKey {
   Back_Space = 127,
@@ -76,33 +222,318 @@ struct editorSyntax {
   int flags;
 };
 
+// highlighting is stored as runs of render bytes with the same color. rows
+// usually have only a handful of runs, and none at all when there is no
+// syntax for the file, so this is much smaller than one byte per column.
+#define HLSPAN_MAX_LEN 0xffffff
+typedef struct hlspan {
+  unsigned int len : 24;
+  unsigned int hl : 8;
+} hlspan;
+
+// hlState is where the highlighter is at some position in a row, enough to
+// carry on from there.
+struct hlState {
+  int in_string;
+  int in_comment;
+  int prev_step;
+  int sl_comment; // after a single line comment start, the rest is comment.
+  unsigned char prev_hl;
+};
+
+// the state of a long row's highlighting, see the long rows section.
+struct hlCheckpoint {
+  size_t at;
+  struct hlState st;
+};
+
+struct longRow {
+  struct editorSyntax *syntax; // the syntax the checkpoints were made with.
+  struct hlCheckpoint *chk;
+  size_t nchk, chkcap;
+  size_t valid;
+  // chk[0..valid) are right. the others are from before the last edits,
+  // moved to where their text is now.
+  int end_known;
+  // end_known is set when hl_open_comment is right, provided that
+  // chk[valid..nchk) are.
+  int edited, ascii_edit;
+  // set by longRowEdit() for the editorUpdateRow() that follows it.
+};
+
+// hlPass is a run of the highlighter over a long row that saves checkpoints
+// as it goes.
+struct hlPass {
+  struct erow *row;
+  size_t base; // position of the text editorHighlight() was given.
+  size_t due;  // next position longRowStep() wants to see.
+  size_t next; // first old checkpoint that was not reached yet.
+  struct hlCheckpoint *fresh;
+  size_t nfresh, freshcap;
+  int converged;
+};
+
+// rows are indexed with int64_t and measured with size_t, so files with more
+// than 2^31 lines or lines over 2 GB work the same as small ones.
+// a colmark records a sequence of bytes in chars that does not take exactly
+// one column per byte: either a single tab, or a run of consecutive UTF-8
+// multibyte characters. cols[0].cx holds the number of marks that follow
+// it, and rows that are plain ASCII without tabs have cols == NULL.
+typedef struct colmark {
+  size_t cx; // byte offset of the sequence in chars.
+  size_t rx; // column where it starts on screen.
+  size_t rb; // byte offset where it starts in render.
+  unsigned char len;
+  unsigned char width;
+  // len is the number of bytes in chars, width the number of columns. a tab
+  // is one byte in chars and 'width' spaces in render, a run of multibyte
+  // characters is copied to render as is.
+} colmark;
+
 typedef struct erow {
-  int idx;
-  int size;
-  int rsize;
+  int64_t idx;
+  size_t size;
+  size_t rsize;
   char *chars;
   char *render;
-  unsigned char *hl;
-  int hl_open_comment;
+  // render points into chars when there is nothing to expand.
+  hlspan *hl;
+  colmark *cols;
+  struct longRow *lr;
+  // lr is only set for rows of LONG_ROW_SIZE bytes or more, which have no hl
+  // spans, see the long rows section.
+  uint32_t nhl;
+  // nhl is the number of spans in hl, past the last span everything is
+  // HL_NORMAL.
+  unsigned char hl_open_comment;
+  unsigned char render_shared;
+  unsigned char words_counted;
+  // words_counted is set while the words in chars are counted in E.words.
   // global struct to store the editor configuration.
 } erow;
+
+struct slabBlock {
+  struct slabBlock *next;
+};
+
+struct rowSlab {
+  void *freelist[SLAB_CLASSES];
+  char *bump;
+  size_t bumpleft;
+  struct slabBlock *blocks;
+  size_t inuse;    // bytes handed out to rows, rounded up to the class size.
+  size_t reserved; // bytes of slab blocks obtained from malloc().
+};
+
+// editorHud holds what the performance HUD (Ctrl-P) shows. nothing is measured
+// while it is off, apart from checking the on flag.
+struct editorHud {
+  int on;
+  int64_t key_time; // when the last key was read, 0 once it was painted.
+  int64_t latency;  // from reading the last key to its frame being written.
+  int64_t hl_time;  // editorUpdateSyntax() time since the last frame.
+  // build, write and bytes describe the last frame written.
+  int64_t build, write;
+  size_t bytes;
+  int64_t mem_time; // when the memory numbers below were last computed.
+  size_t rss, mem_rows, mem_text, mem_render, mem_hl, mem_cols, mem_undo;
+};
+
+// editorFileId is what tells whether a file changed on disk.
+struct editorFileId {
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+  int crlf; // the first line ends in \r\n, see editorRowAtByte().
+};
+
+// editorFollow is follow mode, see the external changes section.
+struct editorFollow {
+  int on;
+  off_t off;       // bytes of the file read into rows so far.
+  int partial;     // the last row has no newline yet.
+  int64_t dropped; // rows dropped from the top to stay under --max-lines.
+};
+
+// editorCompressor is a compressed file format, read and written by piping
+// through an external program, see the compressed files section.
+struct editorCompressor {
+  char *name;
+  char *ext;
+  unsigned char magic[4];
+  int magiclen;
+  char *decompress[4];
+  char *compress[4];
+};
+
+struct editorCompressor COMPRESSORS[] = {
+    {"gzip", ".gz", {0x1f, 0x8b}, 2, {"gzip", "-dc", NULL}, {"gzip", "-c", NULL}},
+    {"zstd", ".zst", {0x28, 0xb5, 0x2f, 0xfd}, 4, {"zstd", "-dcq", NULL},
+     {"zstd", "-cq", NULL}},
+};
+
+#define COMPRESSORS_ENTRIES (sizeof(COMPRESSORS) / sizeof(COMPRESSORS[0]))
+
+// editorStream is a pipe that a buffer is read from, see the reading from
+// stdin section.
+struct editorStream {
+  int fd;      // -1 once everything was read.
+  pid_t pid;   // the decompressor writing to fd, 0 for stdin.
+  off_t bytes; // bytes read so far.
+  off_t size;  // bytes to read, 0 when not known.
+  struct editorCompressor *comp; // how the file is compressed, or NULL.
+};
+
+// editorUndo is the last replace-all, see the replace section.
+struct editorUndo {
+  int64_t nrows;   // rows changed.
+  int64_t *rows;   // their indexes, in order.
+  size_t *ends;    // the old text of rows[i] ends at text[ends[i]].
+  char *text;
+  size_t len, cap; // bytes used and allocated in text.
+  int64_t count;   // replacements made.
+  int undone;      // applying it again redoes the change.
+};
+
+// editorDiff is the diff gutter, see the diff against disk section.
+struct editorDiff {
+  int on;
+  int busy; // the marks are not up to date with the rows yet.
+  int buf, dirty;
+  int64_t numrows;
+  struct editorFileId disk;
+  // what the current work is for: when the rows or the file change it
+  // starts over, keeping the file's hashes if it is the same file.
+  uint64_t *a, *b; // a hash per line of the file and per row.
+  int64_t na, acap, nb, bcap;
+  off_t pos;     // how far into the file a[] goes.
+  int disk_done; // a[] has the whole file.
+  int started;   // the first job was pushed.
+  struct diffJob *jobs;
+  int64_t njobs, jobcap;
+  int64_t *v;
+  size_t vcap;
+  unsigned char *mark, *work; // DIFF_* per row, shown and being made.
+  int64_t nmark, markcap, workcap;
+  int64_t added, changed, deleted;
+};
+
+// editorSymbols is the symbol index, see the symbols section.
+struct editorSymbol {
+  int64_t row;
+  size_t name; // where the name starts in names.
+  size_t off;  // where it starts in the row's render.
+  uint32_t len;
+  uint32_t mask; // the characters in the name, see symbolMask().
+  int kind;
+};
+
+struct editorSymbols {
+  int buf;                     // the buffer indexed, -1 for none.
+  struct editorSyntax *syntax; // the syntax it was indexed with.
+  struct editorSymbol *sym;    // sorted by row.
+  int64_t n, cap;
+  char *names;
+  size_t len, namecap;
+  size_t garbage; // bytes of names that no symbol uses any more.
+  int64_t scan;   // rows from scan on are not indexed yet.
+};
+
+// editorWords is the word index for completion, see the completion section.
+struct wordNode {
+  int32_t parent, child, sibling;
+  uint32_t count; // times the word that ends here is in the rows.
+  uint32_t max;   // the highest count of a word that starts with this one.
+  unsigned char c;
+};
+
+struct editorWords {
+  struct wordNode *node; // node[0] is the empty word.
+  int32_t nnode, nodecap;
+  int32_t *slot; // node + 1 by parent and character, 0 for none.
+  uint32_t nslot;
+  int32_t nfree; // first node of the list of unused ones, -1 for none.
+  int64_t total; // words counted.
+  int on;        // set once completion was used, nothing is counted before.
+  int buf;       // the buffer being counted, -1 for none.
+  int64_t scan;  // rows from scan on may not be counted yet.
+  // the last Ctrl-Y, so that pressing it again takes the next candidate.
+  int64_t cy;
+  size_t start, cx, plen;
+  int which, ncand;
+  char cand[WORD_CANDIDATES][WORD_MAX + 1];
+  char hint[80]; // the last message about completions.
+};
+
 struct editorConfig {
-  int cx, cy;
+  size_t cx;
+  int64_t cy;
   // cx and cy are the x and y coordinates of the cursor.
-  int rx;
+  size_t rx;
   // rx is the x coordinate of the cursor in the render field.
-  int rowoff;
-  int coloff;
+  int64_t rowoff;
+  size_t coloff;
+  int softwrap;
+  size_t wrapoff;
+  // with soft wrap on (Ctrl-W), coloff is 0 and the screen starts at screen
+  // line wrapoff of row rowoff.
   int screenrows;
   int screencols;
 
-  int numrows;
+  int64_t numrows;
   erow *row;
   int dirty;
   char *filename;
   char statusmsg[80];
   time_t statusmsg_time;
   struct editorSyntax *syntax;
+  struct editorPager *pager;
+  // pager is NULL unless the file was opened in paging mode.
+  struct editorHex *hex;
+  // hex is NULL unless the file is shown in hex view.
+  struct editorFileId disk;
+  // disk is the file as it was when it was last read or written.
+  struct editorFollow follow;
+  struct editorStream stream;
+  struct rowSlab slab;
+  int64_t match_row;
+  size_t match_off, match_len;
+  // the current search match, drawn as HL_MATCH on top of the row's spans.
+  int outfd;
+  // frames are written to outfd, stdout unless a replay runs headless.
+  FILE *record;
+  int64_t record_start;
+  struct editorReplay *replay;
+  // record and replay are NULL unless --record or --replay was given.
+  struct editorHud hud;
+  struct editorUndo undo;
+  struct editorDiff diff;
+  struct editorSymbols sym;
+  struct editorWords words;
+  struct editorBuffer *buf;
+  int nbuf, curbuf;
+  unsigned long buftick;
+  size_t cache_cap;
+  // buf holds one editorBuffer per file, see the buffers section.
+  int inotify_fd, inotify_wd;
+  int checking_disk;
+  int64_t hl_stop;
+  // hl_stop is a row that highlighting is not carried on into, because it
+  // is about to be laid out again anyway. -1 for none.
+  int prompting;
+  // prompting counts the open prompts, rows must not move under them.
+  int64_t follow_max;
+  // follow_max is --max-lines, 0 keeps every row.
+  int stream_buf;
+  // stream_buf is the buffer that stdin is read into, -1 if there is none.
+  struct editorTrace *trace;
+  // trace is NULL unless tracing was started with --trace or Ctrl-T.
+  int server_fd;
+  int session;
+  jmp_buf detach;
+  // server_fd is the socket a --server listens on, session is set while a
+  // client is attached, see the server section.
   struct termios orig_termios;
 };
 
@@ -139,6 +570,22 @@ void die(const char *s) {
   // exit() comes from <stdlib.h> and is used to exit the program.
 }
 
+// writeAll() keeps calling write() until everything is written. a single
+// write() on Linux never transfers more than about 2 GB.
+int writeAll(int fd, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t w = write(fd, buf, len);
+    if (w == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    buf += w;
+    len -= w;
+  }
+  return 0;
+}
+
 void disableRawMode() {
   if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1) {
     die("tcsetattr");
@@ -199,14 +646,26 @@ void enableRawMode() {
     die("tcsetattr");
 }
 
-int editorReadKey() {
-  // editorReadKey() is to read a single keypress from the user and return it.
+int editorReadTerminalKey() {
+  // editorReadTerminalKey() is to read a single keypress from the user and
+  // return it.
 
-  int nread;
+  int nread, ready;
   char c;
-  while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-    if (nread == -1 && errno != EAGAIN)
+  while ((nread = (ready = editorStreamWait()) ? read(STDIN_FILENO, &c, 1)
+                                               : 0) != 1) {
+    if (E.session &&
+        ((nread == 0 && ready) ||
+         (nread == -1 && errno != EAGAIN && errno != EINTR)))
+      editorDetach();
+    // in a server session stdin is the client's socket, which reads as end
+    // of file once the client is gone.
+    if (nread == -1 && errno != EAGAIN && errno != EINTR)
       die("read");
+    editorIdle();
+    // read() gives up after a tenth of a second without input, see
+    // enableRawMode(), which is when background work gets to run. while
+    // stdin is being read, editorStreamWait() also wakes up for new data.
   }
   if (c == '\x1b') {
     char seq[3];
@@ -262,8 +721,187 @@ int editorReadKey() {
     }
     return '\x1b';
   } else {
-    return c;
+    return (unsigned char)c;
+    // bytes of UTF-8 characters come through as 128-255.
+  }
+}
+
+/*** record and replay */
+
+// --record FILE writes every key editorReadKey() returns to FILE, one
+// "<microseconds since start> <key>" line per key. --replay FILE feeds such a
+// file back without a terminal, as fast as the editor can take it, and
+// prints how long each key took to handle, from the moment it was returned
+// until the next key was asked for, which includes drawing the frame.
+
+struct editorReplay {
+  FILE *in;
+  int64_t *lat;
+  // lat holds the latency of every replayed key in nanoseconds.
+  size_t nlat, latcap;
+  int64_t key_start;
+  // key_start is when the last key was handed out, 0 before the first.
+  size_t frames, frame_bytes, max_frame;
+};
+
+int64_t editorNow() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void editorRecordKey(int key) {
+  fprintf(E.record, "%" PRId64 " %d\n", (editorNow() - E.record_start) / 1000,
+          key);
+}
+
+void editorReplayOpen(const char *filename) {
+  struct editorReplay *r = calloc(1, sizeof(*r));
+  if (r == NULL || (r->in = fopen(filename, "r")) == NULL)
+    die("replay");
+  E.replay = r;
+}
+
+void editorReplayFrame(size_t len) {
+  struct editorReplay *r = E.replay;
+  r->frames++;
+  r->frame_bytes += len;
+  if (len > r->max_frame)
+    r->max_frame = len;
+}
+
+int cmpInt64(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+// editorReplayReport() runs at exit, whether the file ran out or a replayed
+// Ctrl-Q quit the editor.
+void editorReplayReport() {
+  struct editorReplay *r = E.replay;
+  if (isatty(E.outfd))
+    write(E.outfd, "\x1b[2J\x1b[H", 7);
+
+  printf("replay: %zu keys, %zu frames\n", r->nlat, r->frames);
+  if (r->frames)
+    printf("frame bytes: avg %zu, max %zu\n", r->frame_bytes / r->frames,
+           r->max_frame);
+  if (r->nlat == 0)
+    return;
+
+  qsort(r->lat, r->nlat, sizeof(int64_t), cmpInt64);
+  printf("latency: p50 %.1f us, p99 %.1f us, max %.1f us\n",
+         r->lat[r->nlat / 2] / 1e3, r->lat[r->nlat * 99 / 100] / 1e3,
+         r->lat[r->nlat - 1] / 1e3);
+
+  // a histogram with power of two buckets, in microseconds.
+  size_t buckets[32] = {0};
+  int last = 0;
+  for (size_t i = 0; i < r->nlat; i++) {
+    int b = 0;
+    while (b < 31 && (r->lat[i] / 1000) >> b)
+      b++;
+    buckets[b]++;
+    if (b > last)
+      last = b;
+  }
+  for (int b = 0; b <= last; b++) {
+    size_t bar = buckets[b] * 40 / r->nlat;
+    printf("%10lld us %8zu ", b ? 1LL << (b - 1) : 0LL, buckets[b]);
+    for (size_t i = 0; i < bar; i++)
+      putchar('#');
+    putchar('\n');
+  }
+}
+
+int editorReplayKey() {
+  struct editorReplay *r = E.replay;
+  int64_t now = editorNow();
+  if (r->key_start) {
+    if (r->nlat == r->latcap) {
+      r->latcap = r->latcap ? r->latcap * 2 : 1024;
+      r->lat = realloc(r->lat, r->latcap * sizeof(int64_t));
+      if (r->lat == NULL)
+        die("realloc");
+    }
+    r->lat[r->nlat++] = now - r->key_start;
+  }
+
+  char line[64];
+  long long usec;
+  int key;
+  while (fgets(line, sizeof(line), r->in)) {
+    if (sscanf(line, "%lld %d", &usec, &key) == 2) {
+      r->key_start = editorNow();
+      return key;
+    }
+  }
+  exit(0);
+}
+
+int editorReadKey() {
+  int64_t start = TRACE_BEGIN();
+  int c = E.replay ? editorReplayKey() : editorReadTerminalKey();
+  TRACE_END("read key", start);
+  if (E.record)
+    editorRecordKey(c);
+  if (E.hud.on)
+    E.hud.key_time = editorNow();
+  return c;
+}
+
+/*** tracing */
+
+// spans of the main loop stages go into a ring buffer holding the last
+// TRACE_EVENTS of them. Ctrl-T and exit write the ring as Chrome trace JSON,
+// which chrome://tracing and Perfetto (ui.perfetto.dev) can open.
+
+struct traceEvent {
+  const char *name;
+  int64_t start, dur;
+};
+
+struct editorTrace {
+  char *filename;
+  struct traceEvent ev[TRACE_EVENTS];
+  size_t next;
+  // next is the number of spans ever recorded, the ring slot is next %
+  // TRACE_EVENTS.
+};
+
+void traceEnd(const char *name, int64_t start) {
+  struct traceEvent *ev = &E.trace->ev[E.trace->next++ % TRACE_EVENTS];
+  ev->name = name;
+  ev->start = start;
+  ev->dur = editorNow() - start;
+}
+
+int traceDump() {
+  struct editorTrace *t = E.trace;
+  FILE *fp = fopen(t->filename, "w");
+  if (fp == NULL)
+    return -1;
+  size_t n = t->next < TRACE_EVENTS ? t->next : TRACE_EVENTS;
+  fprintf(fp, "{\"traceEvents\":[\n");
+  for (size_t i = 0; i < n; i++) {
+    struct traceEvent *ev = &t->ev[(t->next - n + i) % TRACE_EVENTS];
+    fprintf(fp,
+            "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+            "\"pid\":%d,\"tid\":1}%s\n",
+            ev->name, ev->start / 1e3, ev->dur / 1e3, (int)getpid(),
+            i + 1 < n ? "," : "");
   }
+  fprintf(fp, "],\"displayTimeUnit\":\"ms\"}\n");
+  return fclose(fp);
+}
+
+void traceAtExit() { traceDump(); }
+
+void traceStart(const char *filename) {
+  E.trace = calloc(1, sizeof(struct editorTrace));
+  if (E.trace == NULL || (E.trace->filename = strdup(filename)) == NULL)
+    die("trace");
+  atexit(traceAtExit);
 }
 
 int getCursorPosition(int *rows, int *cols) {
@@ -337,41 +975,105 @@ int is_separator(int c) {
   // character in a string.
 }
 
-void editorUpdateSyntax(erow *row) {
-  row->hl = realloc(row->hl, row->rsize);
-  memset(row->hl, HL_NORMAL, row->rsize);
+unsigned char *editorHlScratch(size_t len) {
+  static unsigned char *scratch = NULL;
+  static size_t cap = 0;
+  if (len > cap) {
+    cap = len * 2;
+    scratch = realloc(scratch, cap);
+    if (scratch == NULL)
+      die("realloc");
+  }
+  return scratch;
+}
+
+// editorStoreSpans() packs one highlight byte per render byte into the row's
+// spans. a NULL hl means the whole row is HL_NORMAL.
+void editorStoreSpans(erow *row, unsigned char *hl) {
+  size_t end = 0;
+  // end is one past the last byte that is not HL_NORMAL, trailing normal
+  // text does not need a span.
+  if (hl) {
+    for (size_t i = row->rsize; i > 0; i--) {
+      if (hl[i - 1] != HL_NORMAL) {
+        end = i;
+        break;
+      }
+    }
+  }
+
+  size_t n = 0;
+  for (size_t i = 0; i < end; n++) {
+    size_t j = i + 1;
+    while (j < end && hl[j] == hl[i] && j - i < HLSPAN_MAX_LEN)
+      j++;
+    i = j;
+  }
+
+  row->hl = rowRealloc(row->hl, row->nhl * sizeof(hlspan), n * sizeof(hlspan));
+  row->nhl = n;
+
+  n = 0;
+  for (size_t i = 0; i < end; n++) {
+    size_t j = i + 1;
+    while (j < end && hl[j] == hl[i] && j - i < HLSPAN_MAX_LEN)
+      j++;
+    row->hl[n].len = j - i;
+    row->hl[n].hl = hl[i];
+    i = j;
+  }
+}
+
+// editorHighlight() highlights s[0..to) into hl one byte per column,
+// starting in state st and leaving st as it is where it stopped. it returns
+// that position, which can be a few bytes past to when a keyword or comment
+// delimiter crosses it, so hl needs HL_SLACK bytes of room past to. len is
+// where the row ends, for looking ahead. pass is only set for long rows, see
+// longRowStep().
+size_t editorHighlight(const char *s, size_t len, size_t to,
+                       struct hlState *st, unsigned char *hl,
+                       struct hlPass *pass) {
+  memset(hl, HL_NORMAL, to);
   // memset() comes from <string.h>
-  if (E.syntax == NULL)
-    return;
 
   char **keywords = E.syntax->keywords;
 
   char *scs = E.syntax->singleline_comment_start;
   char *mcs = E.syntax->multiline_comment_start;
   char *mce = E.syntax->multiline_comment_end;
-  int scs_len = scs ? strlen(scs) : 0;
-  int mcs_len = mcs? strlen(mcs):0;
-  int mce_len = mce ? strlen(mce):0;
-  int prev_step = 1;
-  int in_string = 0; // false
-  int in_comment = (row->idx > 0 && E.row[row->idx - 1].hl_open_comment);
-  int i = 0;
-  while (i < row->rsize) {
-    char c = row->render[i];
-    unsigned char prev_hl = (i > 0) ? row->hl[i - 1] : HL_NORMAL;
-
-    if (scs_len && !in_string && !in_comment) {
-      if (!strncmp(&row->render[i], scs, scs_len)) {
-        memset(&row->hl[i], HL_COMMENT, row->rsize - i);
+  size_t scs_len = scs ? strlen(scs) : 0;
+  size_t mcs_len = mcs? strlen(mcs):0;
+  size_t mce_len = mce ? strlen(mce):0;
+  int prev_step = st->prev_step;
+  int in_string = st->in_string;
+  int in_comment = st->in_comment;
+  int sl_comment = st->sl_comment;
+  size_t i = 0;
+  while (i < to) {
+    unsigned char c = s[i];
+    unsigned char prev_hl = (i > 0) ? hl[i - 1] : st->prev_hl;
+
+    if (pass && pass->base + i >= pass->due) {
+      struct hlState here = {in_string, in_comment, prev_step, sl_comment,
+                             prev_hl};
+      if (longRowStep(pass, pass->base + i, &here))
         break;
-      }
+    }
+
+    if (!sl_comment && scs_len && !in_string && !in_comment &&
+        !strncmp(&s[i], scs, scs_len))
+      sl_comment = 1;
+    if (sl_comment) {
+      memset(&hl[i], HL_COMMENT, to - i);
+      i = to;
+      break;
     }
 
     if(mcs_len && mce_len && !in_string){
       if(in_comment) {
-       row->hl[i] = HL_MLCOMMENT;
-      if(!strncmp(&row->render[i],mce,mce_len)){
-           memset(&row->hl[i],HL_MLCOMMENT,mce_len);
+       hl[i] = HL_MLCOMMENT;
+      if(!strncmp(&s[i],mce,mce_len)){
+           memset(&hl[i],HL_MLCOMMENT,mce_len);
           i += mce_len;
           in_comment =0 ;
           prev_step = 1;
@@ -380,8 +1082,8 @@ void editorUpdateSyntax(erow *row) {
           i++;
           continue;
         }
-      }else if (!strncmp(&row->render[i],mcs,mcs_len)){
-        memset(&row->hl[i],HL_MLCOMMENT,mcs_len);
+      }else if (!strncmp(&s[i],mcs,mcs_len)){
+        memset(&hl[i],HL_MLCOMMENT,mcs_len);
         i += mcs_len;
         in_comment = 1;
         continue;
@@ -390,12 +1092,11 @@ void editorUpdateSyntax(erow *row) {
     }
 
 
-
     if (E.syntax->flags & HL_HIGHLIGHT_STRING) {
       if (in_string) {
-        row->hl[i] = HL_STRING;
-        if (c == '\\' && i + 1 < row->rsize) {
-          row->hl[i + 1] = HL_STRING;
+        hl[i] = HL_STRING;
+        if (c == '\\' && i + 1 < len) {
+          hl[i + 1] = HL_STRING;
           i += 2;
           continue;
         }
@@ -407,7 +1108,7 @@ void editorUpdateSyntax(erow *row) {
       } else {
         if (c == '"' || c == '\'') {
           in_string = c;
-          row->hl[i] = HL_STRING;
+          hl[i] = HL_STRING;
           i++;
           continue;
         }
@@ -416,7 +1117,7 @@ void editorUpdateSyntax(erow *row) {
     if (E.syntax->flags & HL_HIGHLIGHT_NUMBER) {
       if ((isdigit(c) && (prev_step || prev_hl == HL_NORMAL)) ||
           (c == '.' && prev_hl == HL_NUMBER)) {
-        row->hl[i] = HL_NUMBER;
+        hl[i] = HL_NUMBER;
         i++;
         prev_step = 0;
         continue;
@@ -426,14 +1127,14 @@ void editorUpdateSyntax(erow *row) {
     if (prev_step) {
       int j;
       for (j = 0; keywords[j]; j++) {
-        int klen = strlen(keywords[j]);
+        size_t klen = strlen(keywords[j]);
         int kw2 = keywords[j][klen - 1] == '|';
         if (kw2)
           klen--;
 
-        if (!strncmp(&row->render[i], keywords[j], klen) &&
-            is_separator(row->render[i + klen])) {
-          memset(&row->hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
+        if (!strncmp(&s[i], keywords[j], klen) &&
+            is_separator((unsigned char)s[i + klen])) {
+          memset(&hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
           i += klen;
           break;
         }
@@ -447,9 +1148,287 @@ void editorUpdateSyntax(erow *row) {
     i++;
   }
 
-  int changed = (row->hl_open_comment != in_comment);
-  row->hl_open_comment = in_comment;
-  if(changed && row->idx + 1 < E.numrows) editorUpdateSyntax(&E.row[row->idx + 1]);
+  st->prev_hl = (i > 0) ? hl[i - 1] : st->prev_hl;
+  st->in_string = in_string;
+  st->in_comment = in_comment;
+  st->prev_step = prev_step;
+  st->sl_comment = sl_comment;
+  return i;
+}
+
+// editorRowOpenComment() tells whether row at ends inside a multiline
+// comment, which is where the row after it starts.
+int editorRowOpenComment(int64_t at) {
+  erow *row = editorCachedRow(at);
+  if (row == NULL && E.pager && at >= 0 && at < E.numrows) {
+    int open = pagerCommentAt(E.pager, at + 1);
+    return open == -1 ? 0 : open;
+  }
+  if (row == NULL)
+    return 0;
+  if (row->lr)
+    longRowEnd(row);
+  return row->hl_open_comment;
+}
+
+void editorUpdateSyntax(erow *row) {
+  if (row->lr) {
+    longRowSyntax(row);
+    symbolRow(row);
+    return;
+  }
+  if (E.syntax == NULL) {
+    editorStoreSpans(row, NULL);
+    return;
+  }
+  struct hlState st = {0, editorRowOpenComment(row->idx - 1), 1, 0,
+                       HL_NORMAL};
+  // the row is highlighted one byte per column into a shared scratch buffer
+  // and then packed into spans.
+  unsigned char *hl = editorHlScratch(row->rsize + HL_SLACK);
+  editorHighlight(row->render, row->rsize, row->rsize, &st, hl, NULL);
+  editorStoreSpans(row, hl);
+  symbolRow(row);
+
+  int changed = (row->hl_open_comment != st.in_comment);
+  row->hl_open_comment = st.in_comment;
+  erow *next = editorCachedRow(row->idx + 1);
+  if (changed && next && next->idx != E.hl_stop)
+    editorUpdateSyntax(next);
+}
+
+/*** long rows */
+
+// a row of LONG_ROW_SIZE bytes or more, like a minified bundle, is never
+// highlighted as a whole. instead the highlighter state is saved about every
+// LONG_ROW_CHUNK bytes of chars, and only what is on screen is highlighted,
+// starting at the checkpoint before it. an edit only invalidates the
+// checkpoints after it, and once highlighting from there reaches an old
+// checkpoint in the same state the rest of the row is known to be as before.
+// long rows are highlighted on chars rather than render, so that edits move
+// checkpoints by exactly the number of bytes inserted or deleted; tabs and
+// invalid bytes are separators or not in both the same way.
+
+int hlStateEqual(struct hlState *a, struct hlState *b) {
+  return a->in_string == b->in_string && a->in_comment == b->in_comment &&
+         a->prev_step == b->prev_step && a->sl_comment == b->sl_comment &&
+         a->prev_hl == b->prev_hl;
+}
+
+void longRowReset(erow *row) {
+  struct longRow *lr = row->lr;
+  struct hlState start = {0, editorRowOpenComment(row->idx - 1), 1, 0,
+                          HL_NORMAL};
+  if (lr->chkcap == 0) {
+    lr->chkcap = 64;
+    lr->chk = malloc(lr->chkcap * sizeof(struct hlCheckpoint));
+    if (lr->chk == NULL)
+      die("malloc");
+  }
+  lr->syntax = E.syntax;
+  lr->chk[0].at = 0;
+  lr->chk[0].st = start;
+  lr->nchk = 1;
+  lr->valid = 1;
+  lr->end_known = 0;
+}
+
+void longRowDue(struct hlPass *pass) {
+  struct longRow *lr = pass->row->lr;
+  size_t last = pass->nfresh ? pass->fresh[pass->nfresh - 1].at
+                             : lr->chk[lr->valid - 1].at;
+  pass->due = last + LONG_ROW_CHUNK;
+  if (pass->next < lr->nchk && lr->chk[pass->next].at < pass->due)
+    pass->due = lr->chk[pass->next].at;
+}
+
+// longRowStep() is called by editorHighlight() with the state at position
+// at. it saves a checkpoint when one is due and returns 1 when the pass
+// has caught up with an old checkpoint, so the rest of the row is unchanged.
+int longRowStep(struct hlPass *pass, size_t at, struct hlState *st) {
+  struct longRow *lr = pass->row->lr;
+  while (pass->next < lr->nchk && lr->chk[pass->next].at < at)
+    pass->next++;
+  // old checkpoints the highlighter jumped over are dropped.
+
+  int old = pass->next < lr->nchk && lr->chk[pass->next].at == at;
+  if (old && hlStateEqual(&lr->chk[pass->next].st, st)) {
+    pass->converged = 1;
+    return 1;
+  }
+  if (old || at >= pass->due) {
+    if (pass->nfresh == pass->freshcap) {
+      pass->freshcap = pass->freshcap ? pass->freshcap * 2 : 64;
+      pass->fresh = realloc(pass->fresh,
+                            pass->freshcap * sizeof(struct hlCheckpoint));
+      if (pass->fresh == NULL)
+        die("realloc");
+    }
+    pass->fresh[pass->nfresh].at = at;
+    pass->fresh[pass->nfresh].st = *st;
+    pass->nfresh++;
+    if (old)
+      pass->next++;
+  }
+  longRowDue(pass);
+  return 0;
+}
+
+// longRowPass() highlights from the last valid checkpoint until it is past
+// target, the old checkpoints agree again, or the row ends.
+void longRowPass(erow *row, size_t target) {
+  struct longRow *lr = row->lr;
+  struct hlPass pass = {row, 0, 0, lr->valid, NULL, 0, 0, 0};
+  longRowDue(&pass);
+
+  struct hlState st = lr->chk[lr->valid - 1].st;
+  size_t i = lr->chk[lr->valid - 1].at;
+  unsigned char *hl = editorHlScratch(LONG_ROW_CHUNK + HL_SLACK);
+  while (i < row->size && i < target && !pass.converged) {
+    size_t to = row->size - i < LONG_ROW_CHUNK ? row->size - i : LONG_ROW_CHUNK;
+    pass.base = i;
+    i += editorHighlight(&row->chars[i], row->size - i, to, &st, hl, &pass);
+  }
+
+  // the checkpoints become chk[0..valid), the fresh ones, and the old ones
+  // not reached yet unless the pass went to the end of the row.
+  int ended = !pass.converged && i >= row->size;
+  size_t keep = ended ? 0 : lr->nchk - pass.next;
+  size_t n = lr->valid + pass.nfresh + keep;
+  if (n > lr->chkcap) {
+    while (n > lr->chkcap)
+      lr->chkcap *= 2;
+    lr->chk = realloc(lr->chk, lr->chkcap * sizeof(struct hlCheckpoint));
+    if (lr->chk == NULL)
+      die("realloc");
+  }
+  memmove(&lr->chk[lr->valid + pass.nfresh], &lr->chk[pass.next],
+          keep * sizeof(struct hlCheckpoint));
+  if (pass.nfresh)
+    memcpy(&lr->chk[lr->valid], pass.fresh,
+           pass.nfresh * sizeof(struct hlCheckpoint));
+  // fresh is still NULL when the pass made no checkpoints.
+  lr->nchk = n;
+  lr->valid = pass.converged || ended ? n : lr->valid + pass.nfresh;
+  if (ended) {
+    lr->end_known = 1;
+    row->hl_open_comment = st.in_comment;
+  }
+  free(pass.fresh);
+}
+
+// longRowEnd() makes sure hl_open_comment is right.
+void longRowEnd(erow *row) {
+  struct longRow *lr = row->lr;
+  if (lr->syntax != E.syntax || lr->nchk == 0)
+    longRowReset(row);
+  if (E.syntax == NULL) {
+    row->hl_open_comment = 0;
+    return;
+  }
+  while (lr->valid < lr->nchk || !lr->end_known)
+    longRowPass(row, row->size);
+}
+
+// longRowSyntax() is editorUpdateSyntax() for long rows. the end of the row
+// is only worked out when there is a row after it that depends on it.
+void longRowSyntax(erow *row) {
+  struct longRow *lr = row->lr;
+  struct hlState start = {0, editorRowOpenComment(row->idx - 1), 1, 0,
+                          HL_NORMAL};
+  if (lr->syntax != E.syntax || lr->nchk == 0 || !lr->edited ||
+      !hlStateEqual(&lr->chk[0].st, &start))
+    longRowReset(row);
+  lr->edited = 0;
+
+  erow *next = editorCachedRow(row->idx + 1);
+  if (E.syntax == NULL || next == NULL)
+    return;
+  int open = row->hl_open_comment;
+  longRowEnd(row);
+  if (row->hl_open_comment != open && next->idx != E.hl_stop)
+    editorUpdateSyntax(next);
+}
+
+// longRowEdit() tells a long row that removed bytes at at were replaced with
+// inserted ones, before editorUpdateRow() is called for it. ascii is set
+// when the new bytes are ASCII without tabs.
+void longRowEdit(erow *row, size_t at, size_t removed, size_t inserted,
+                 int ascii) {
+  struct longRow *lr = row->lr;
+  size_t lo = 0, hi = lr->nchk;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (lr->chk[mid].at <= at)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  // checkpoints up to at only depend on the text before it.
+  size_t k = lo, j = lo;
+  while (j < lr->nchk && lr->chk[j].at <= at + removed)
+    j++;
+  // the ones in the removed text are dropped, the rest move.
+  memmove(&lr->chk[k], &lr->chk[j], (lr->nchk - j) * sizeof(struct hlCheckpoint));
+  lr->nchk -= j - k;
+  for (size_t m = k; m < lr->nchk; m++)
+    lr->chk[m].at = lr->chk[m].at - removed + inserted;
+  if (lr->valid > k)
+    lr->valid = k;
+  if (k == lr->nchk)
+    lr->end_known = 0;
+  // with no old checkpoint after the edit there is nothing a new pass could
+  // agree with again, so the end has to be worked out anew.
+  lr->edited = 1;
+  lr->ascii_edit = ascii;
+}
+
+// longRowWindow() highlights chars[from..to) of a long row for drawing. it
+// returns one byte per position starting at *start, which is at or before
+// from.
+unsigned char *longRowWindow(erow *row, size_t from, size_t to,
+                             size_t *start) {
+  static unsigned char *buf = NULL;
+  static size_t cap = 0;
+  struct longRow *lr = row->lr;
+
+  if (lr->syntax != E.syntax || lr->nchk == 0)
+    longRowReset(row);
+  if (lr->chk[lr->valid - 1].at + LONG_ROW_CHUNK < from)
+    longRowPass(row, from);
+
+  size_t lo = 0, hi = lr->valid;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (lr->chk[mid].at <= from)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  struct hlCheckpoint *c = &lr->chk[lo - 1];
+
+  if (to > row->size)
+    to = row->size;
+  size_t n = to - c->at + HL_SLACK;
+  if (n > cap) {
+    cap = n * 2;
+    buf = realloc(buf, cap);
+    if (buf == NULL)
+      die("realloc");
+  }
+  struct hlState st = c->st;
+  editorHighlight(&row->chars[c->at], row->size - c->at, to - c->at, &st, buf,
+                  NULL);
+  *start = c->at;
+  return buf;
+}
+
+void longRowFree(erow *row) {
+  if (row->lr) {
+    free(row->lr->chk);
+    free(row->lr);
+    row->lr = NULL;
+  }
 }
 
 int editorSyntaxToColor(int hl) {
@@ -491,9 +1470,11 @@ void editorSelectSyntaxHighlight() {
           (!is_ext && strstr(E.filename, s->filematch[i]))) {
         E.syntax = s;
 
-        int filerow;
+        int64_t filerow;
         for (filerow = 0; filerow < E.numrows; filerow++) {
-          editorUpdateSyntax(&E.row[filerow]);
+          erow *row = editorCachedRow(filerow);
+          if (row)
+            editorUpdateSyntax(row);
         }
         return;
       }
@@ -501,155 +1482,1359 @@ void editorSelectSyntaxHighlight() {
     }
   }
 }
-/** row operations */
-
-int editorRowsCxToRx(erow *row, int cx) {
-  int rx = 0;
-  int j;
-  for (j = 0; j < cx; j++) {
-    if (row->chars[j] == '\t')
-      rx += (TEXT_EDITOR_TAB_STOP - 1) - (rx % TEXT_EDITOR_TAB_STOP);
-    rx++;
+/** row memory */
+
+// row payloads (chars, render and hl) come from a slab allocator instead of
+// malloc(). small sizes are rounded up to a size class and carved out of
+// SLAB_BLOCK_SIZE blocks, freed slots go on a per-class free list, and all
+// the blocks are released at once when the file is closed. this saves the
+// malloc header on every one of the three buffers of every row, and most
+// edits no longer move the row because the size stays in the same class.
+// anything above SLAB_MAX_SIZE still goes to malloc().
+//
+// the allocator does not remember sizes: callers pass the same size they
+// allocated with, which for rows is always derivable from size and rsize.
+
+int slabClass(size_t n) {
+  if (n <= SLAB_FINE_MAX)
+    return (n + SLAB_GRAIN - 1) / SLAB_GRAIN - 1;
+  int c = SLAB_FINE_MAX / SLAB_GRAIN;
+  size_t sz = SLAB_FINE_MAX * 2;
+  while (sz < n) {
+    sz *= 2;
+    c++;
   }
+  return c;
+}
 
-  return rx;
+size_t slabClassSize(int c) {
+  if (c < SLAB_FINE_MAX / SLAB_GRAIN)
+    return (size_t)(c + 1) * SLAB_GRAIN;
+  return (size_t)SLAB_FINE_MAX << (c - SLAB_FINE_MAX / SLAB_GRAIN + 1);
 }
 
-int editorRowRxToCx(erow *row, int rx) {
-  int cur_rx = 0;
-  int cx;
+void *rowAlloc(size_t n) {
+  if (n == 0)
+    return NULL;
+  if (n > SLAB_MAX_SIZE) {
+    void *p = malloc(n);
+    if (p == NULL)
+      die("malloc");
+    E.slab.inuse += n;
+    return p;
+  }
 
-  for (cx = 0; cx < row->size; cx++) {
-    if (row->chars[cx] == '\t')
-      cur_rx += (TEXT_EDITOR_TAB_STOP - 1) - (cur_rx % TEXT_EDITOR_TAB_STOP);
+  int c = slabClass(n);
+  size_t sz = slabClassSize(c);
+  struct rowSlab *s = &E.slab;
+  E.slab.inuse += sz;
 
-    if (cur_rx > rx)
-      return cx;
+  if (s->freelist[c]) {
+    void *p = s->freelist[c];
+    s->freelist[c] = *(void **)p;
+    // a free slot stores the pointer to the next free slot in its first bytes.
+    return p;
   }
-  return cx;
-}
 
-void editorUpdateRow(erow *row) {
+  if (s->bumpleft < sz) {
+    struct slabBlock *b = malloc(SLAB_BLOCK_SIZE);
+    if (b == NULL)
+      die("malloc");
+    b->next = s->blocks;
+    s->blocks = b;
+    s->bump = (char *)b + sizeof(struct slabBlock);
+    s->bumpleft = SLAB_BLOCK_SIZE - sizeof(struct slabBlock);
+    s->reserved += SLAB_BLOCK_SIZE;
+  }
+  void *p = s->bump;
+  s->bump += sz;
+  s->bumpleft -= sz;
+  return p;
+}
 
-  int tabs = 0;
+void rowFree(void *p, size_t n) {
+  if (p == NULL || n == 0)
+    return;
+  if (n > SLAB_MAX_SIZE) {
+    free(p);
+    E.slab.inuse -= n;
+    return;
+  }
+  int c = slabClass(n);
+  *(void **)p = E.slab.freelist[c];
+  E.slab.freelist[c] = p;
+  E.slab.inuse -= slabClassSize(c);
+}
 
-  int j;
+// rowRealloc() grows or shrinks an allocation of 'oldn' bytes to 'n' bytes.
+// as long as both sizes fall in the same class nothing is copied.
+void *rowRealloc(void *p, size_t oldn, size_t n) {
+  if (p == NULL)
+    return rowAlloc(n);
+  if (oldn > SLAB_MAX_SIZE && n > SLAB_MAX_SIZE) {
+    void *new = realloc(p, n);
+    if (new == NULL)
+      die("realloc");
+    E.slab.inuse += n - oldn;
+    return new;
+  }
+  if (oldn <= SLAB_MAX_SIZE && n <= SLAB_MAX_SIZE && oldn > 0 && n > 0 &&
+      slabClass(oldn) == slabClass(n))
+    return p;
+
+  void *new = rowAlloc(n);
+  if (new)
+    memcpy(new, p, oldn < n ? oldn : n);
+  rowFree(p, oldn);
+  return new;
+}
 
-  for (j = 0; j < row->size; j++) {
-    if (row->chars[j] == '\t')
-      tabs++;
+// slabFreeAll() drops every slab block in one go. rows must not be used after
+// this, and rows bigger than SLAB_MAX_SIZE must have been freed before.
+void slabFreeAll(struct rowSlab *s) {
+  while (s->blocks) {
+    struct slabBlock *next = s->blocks->next;
+    free(s->blocks);
+    s->blocks = next;
   }
+  memset(s, 0, sizeof(*s));
+}
 
-  free(row->render);
-  row->render = malloc(row->size + tabs * (TEXT_EDITOR_TAB_STOP - 1) + 1);
+/** unicode */
 
-  int idx = 0;
+// utf8Decode() decodes the character at the start of s. it returns its length
+// in bytes, or 0 when s does not start with a valid, shortest-form UTF-8
+// sequence. C1 control characters are reported as invalid too, so they are
+// never sent to the terminal as is.
+int utf8Decode(const char *s, size_t n, uint32_t *cp) {
+  const unsigned char *u = (const unsigned char *)s;
+  if (n == 0)
+    return 0;
+  if (u[0] < 0x80) {
+    *cp = u[0];
+    return 1;
+  }
 
-  for (j = 0; j < row->size; j++) {
-    if (row->chars[j] == '\t') {
-      row->render[idx++] = ' ';
-      while (idx % (TEXT_EDITOR_TAB_STOP - 1) != 0)
-        row->render[idx++] = ' ';
-    } else {
-      row->render[idx++] = row->chars[j];
-    }
+  int len;
+  uint32_t c, min;
+  if ((u[0] & 0xe0) == 0xc0) {
+    len = 2;
+    c = u[0] & 0x1f;
+    min = 0xa0;
+  } else if ((u[0] & 0xf0) == 0xe0) {
+    len = 3;
+    c = u[0] & 0x0f;
+    min = 0x800;
+  } else if ((u[0] & 0xf8) == 0xf0) {
+    len = 4;
+    c = u[0] & 0x07;
+    min = 0x10000;
+  } else {
+    return 0;
+  }
+  if ((size_t)len > n)
+    return 0;
+  for (int i = 1; i < len; i++) {
+    if ((u[i] & 0xc0) != 0x80)
+      return 0;
+    c = (c << 6) | (u[i] & 0x3f);
   }
-  row->render[idx] = '\0';
-  row->rsize = idx;
+  if (c < min || c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff))
+    return 0;
+  *cp = c;
+  return len;
+}
+
+struct widthRange {
+  uint32_t first, last;
+};
+
+// East Asian Wide and Fullwidth characters, which take two columns.
+struct widthRange wide_chars[] = {
+    {0x1100, 0x115f},   {0x231a, 0x231b},   {0x2329, 0x232a},
+    {0x23e9, 0x23ec},   {0x23f0, 0x23f0},   {0x23f3, 0x23f3},
+    {0x25fd, 0x25fe},   {0x2614, 0x2615},   {0x2648, 0x2653},
+    {0x267f, 0x267f},   {0x2693, 0x2693},   {0x26a1, 0x26a1},
+    {0x26aa, 0x26ab},   {0x26bd, 0x26be},   {0x26c4, 0x26c5},
+    {0x26ce, 0x26ce},   {0x26d4, 0x26d4},   {0x26ea, 0x26ea},
+    {0x26f2, 0x26f3},   {0x26f5, 0x26f5},   {0x26fa, 0x26fa},
+    {0x26fd, 0x26fd},   {0x2705, 0x2705},   {0x270a, 0x270b},
+    {0x2728, 0x2728},   {0x274c, 0x274c},   {0x274e, 0x274e},
+    {0x2753, 0x2755},   {0x2757, 0x2757},   {0x2795, 0x2797},
+    {0x27b0, 0x27b0},   {0x27bf, 0x27bf},   {0x2b1b, 0x2b1c},
+    {0x2b50, 0x2b50},   {0x2b55, 0x2b55},   {0x2e80, 0x303e},
+    {0x3041, 0x33ff},   {0x3400, 0x4dbf},   {0x4e00, 0x9fff},
+    {0xa000, 0xa4cf},   {0xa960, 0xa97f},   {0xac00, 0xd7a3},
+    {0xf900, 0xfaff},   {0xfe10, 0xfe19},   {0xfe30, 0xfe6f},
+    {0xff00, 0xff60},   {0xffe0, 0xffe6},   {0x16fe0, 0x16fe4},
+    {0x17000, 0x18cff}, {0x1b000, 0x1b2ff}, {0x1f004, 0x1f004},
+    {0x1f0cf, 0x1f0cf}, {0x1f18e, 0x1f18e}, {0x1f191, 0x1f19a},
+    {0x1f200, 0x1f251}, {0x1f300, 0x1f64f}, {0x1f680, 0x1f6ff},
+    {0x1f7e0, 0x1f7eb}, {0x1f90c, 0x1f9ff}, {0x1fa70, 0x1faff},
+    {0x20000, 0x2fffd}, {0x30000, 0x3fffd},
+};
+
+// combining marks and other characters that take no column of their own.
+struct widthRange zero_width_chars[] = {
+    {0x0300, 0x036f}, {0x0483, 0x0489}, {0x0591, 0x05bd}, {0x0610, 0x061a},
+    {0x064b, 0x065f}, {0x1ab0, 0x1aff}, {0x1dc0, 0x1dff}, {0x200b, 0x200f},
+    {0x20d0, 0x20ff}, {0xfe00, 0xfe0f}, {0xfe20, 0xfe2f}, {0xe0100, 0xe01ef},
+};
 
-  editorUpdateSyntax(row);
+int widthRangeFind(struct widthRange *r, int n, uint32_t cp) {
+  int lo = 0, hi = n - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    if (cp < r[mid].first)
+      hi = mid - 1;
+    else if (cp > r[mid].last)
+      lo = mid + 1;
+    else
+      return 1;
+  }
+  return 0;
 }
 
-void editorInsertRow(int at, char *s, size_t len) {
+// editorCharWidth() is the number of terminal columns a character takes.
+int editorCharWidth(uint32_t cp) {
+  if (cp < 0x300)
+    return 1;
+  if (widthRangeFind(zero_width_chars,
+                     sizeof(zero_width_chars) / sizeof(zero_width_chars[0]),
+                     cp))
+    return 0;
+  if (cp >= 0x1100 &&
+      widthRangeFind(wide_chars, sizeof(wide_chars) / sizeof(wide_chars[0]),
+                     cp))
+    return 2;
+  return 1;
+}
 
-  if (at < 0 || at > E.numrows)
-    return;
-  E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
-  memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numrows - at));
-  for(int j = at + 1;j <= E.numrows;j++) E.row[j].idx++;  
-  E.row[at].idx = at;
+// editorAsciiPrefix() returns how many bytes at the start of s are ASCII
+// other than tab, which are the bytes that take one column each and render
+// as themselves. most files are all ASCII, so this is what keeps the UTF-8
+// support free for them: 16 bytes are checked at once with SSE2, or 8 at
+// once with plain 64-bit arithmetic elsewhere.
+size_t editorAsciiPrefix(const char *s, size_t n) {
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128i tab = _mm_set1_epi8('\t');
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+    // bytes >= 0x80 already have their top bit set, tabs get it from the
+    // compare, and movemask collects the top bits.
+    int mask = _mm_movemask_epi8(_mm_or_si128(v, _mm_cmpeq_epi8(v, tab)));
+    if (mask)
+      return i + __builtin_ctz(mask);
+  }
+#else
+  for (; i + 8 <= n; i += 8) {
+    uint64_t w, t;
+    memcpy(&w, s + i, 8);
+    t = w ^ 0x0909090909090909ULL;
+    // t has a zero byte wherever w has a tab.
+    if ((w | ((t - 0x0101010101010101ULL) & ~t)) & 0x8080808080808080ULL)
+      break;
+  }
+#endif
+  for (; i < n; i++) {
+    unsigned char c = s[i];
+    if (c >= 0x80 || c == '\t')
+      break;
+  }
+  return i;
+}
 
-  E.row[at].size = len;
-  E.row[at].chars = malloc(len + 1);
-  if (E.row[at].chars == NULL)
-    die("malloc");
+/** row operations */
 
-  memcpy(E.row[at].chars, s, len);
-  E.row[at].chars[len] = '\0';
+// editorColsSize() is the number of bytes allocated for a row's colmarks.
+size_t editorColsSize(colmark *cols) {
+  return cols ? (cols[0].cx + 1) * sizeof(colmark) : 0;
+}
 
-  E.row[at].rsize = 0;
-  E.row[at].render = NULL;
-  E.row[at].hl = NULL;
-  E.row[at].hl_open_comment = 0;
-  editorUpdateRow(&E.row[at]);
+// a position in a row can be given as a byte offset in chars (MAP_CX), a
+// screen column (MAP_RX) or a byte offset in render (MAP_RB).
+enum editorColumn { MAP_CX, MAP_RX, MAP_RB };
 
-  E.numrows++;
-  E.dirty++;
+size_t colmarkStart(colmark *m, int f) {
+  return f == MAP_CX ? m->cx : f == MAP_RX ? m->rx : m->rb;
 }
 
-void editorFreeRow(erow *row) {
-  free(row->render);
-  free(row->chars);
-  free(row->hl);
-  // free the memory
+size_t colmarkExtent(colmark *m, int f) {
+  if (f == MAP_RX || (f == MAP_RB && m->len == 1))
+    return m->width;
+  return m->len;
 }
 
-void editorDelRow(int at) {
-  if (at < 0 || at >= E.numrows) {
-    return;
+// editorRowMap() converts a position in a row from one kind to another. it
+// binary searches the row's colmarks; between two marks every byte is one
+// column, so only the mark before the position matters and the cost does
+// not grow with the length of the row. a position inside a multibyte or wide
+// character maps to the start of that character.
+size_t editorRowMap(erow *row, int from, int to, size_t v) {
+  if (row->cols == NULL)
+    return v;
+  colmark *m = row->cols + 1;
+  size_t lo = 0, hi = row->cols[0].cx;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (colmarkStart(&m[mid], from) <= v)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == 0)
+    return v;
+  m = &m[lo - 1];
+  // m is the last mark that starts at or before v.
+
+  size_t start = colmarkStart(m, from);
+  size_t ext = colmarkExtent(m, from);
+  if (v >= start + ext)
+    return colmarkStart(m, to) + colmarkExtent(m, to) + (v - start - ext);
+
+  if (m->len == 1) {
+    // inside a tab, which is one byte in chars but spaces in render.
+    if (from == MAP_CX || to == MAP_CX)
+      return colmarkStart(m, to);
+    return colmarkStart(m, to) + (v - start);
   }
-  editorFreeRow(&E.row[at]);
-  memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at - 1));
-  for(int j = at;j < E.numrows - 1;j++) E.row[j].idx--;
-  E.numrows--;
-  E.dirty++;
-}
 
-void editorRowInsertChar(erow *row, int at, int c) {
-  if (at < 0 || at > row->size) {
-    at = row->size;
+  // inside a run of multibyte characters, walk it a character at a time.
+  size_t cx = m->cx, rx = m->rx;
+  while (cx < m->cx + m->len) {
+    uint32_t cp;
+    size_t clen = utf8Decode(&row->chars[cx], row->size - cx, &cp);
+    size_t w = editorCharWidth(cp);
+    size_t here = from == MAP_RX ? rx : from == MAP_CX ? cx : m->rb + cx - m->cx;
+    if (v < here + (from == MAP_RX ? w : clen))
+      break;
+    cx += clen;
+    rx += w;
   }
+  return to == MAP_RX ? rx : to == MAP_CX ? cx : m->rb + cx - m->cx;
+}
 
-  row->chars = realloc(row->chars, row->size + 2);
-  // the realloc() function is used to allocate memory.
-  // the row->chars is the buffer.
-  // the row->size is the length of the buffer.
+size_t editorRowsCxToRx(erow *row, size_t cx) {
+  return editorRowMap(row, MAP_CX, MAP_RX, cx);
+}
 
-  memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
-  // the memmove() function is used to copy memory from one location to another.
-  // the &row->chars[at + 1] is the destination.
-  // the &row->chars[at] is the source.
-  // the row->size - at + 1 is the number of bytes to copy.
-  row->size++;
-  row->chars[at] = c;
-  editorUpdateRow(row);
-  E.dirty++;
+size_t editorRowRxToCx(erow *row, size_t rx) {
+  size_t cx = editorRowMap(row, MAP_RX, MAP_CX, rx);
+  return cx < row->size ? cx : row->size;
 }
 
-void editorRowAppendString(erow *row, char *s, size_t len) {
-  row->chars = realloc(row->chars, row->size + len + 1);
-  // we use realloc() to allocate memory for the new string. which is the old
-  // size + the length of the new string + 1 for the null terminator.
-  memcpy(&row->chars[row->size], s, len);
-  row->size += len;
-  row->chars[row->size] = '\0';
-  editorUpdateRow(row);
-  E.dirty++;
+// editorRowNextChar() and editorRowPrevChar() step over one whole character,
+// or over one byte where the row is not valid UTF-8.
+size_t editorRowNextChar(erow *row, size_t cx) {
+  uint32_t cp;
+  int len = utf8Decode(&row->chars[cx], row->size - cx, &cp);
+  return cx + (len ? len : 1);
 }
 
-void editorRowDelChar(erow *row, int at) {
-  if (at < 0 || at >= row->size)
-    return;
-  memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
-  // the memmove() function is used to copy memory from one location to another.
-  // we are overwriting the character at the cursor with the character after it.
-  // and then we are moving the rest of the characters to the left.
-  row->size--;
-  editorUpdateRow(row);
-  E.dirty++;
+size_t editorRowPrevChar(erow *row, size_t cx) {
+  size_t p = cx - 1;
+  while (p > 0 && cx - p < 4 && ((unsigned char)row->chars[p] & 0xc0) == 0x80)
+    p--;
+  uint32_t cp;
+  int len = utf8Decode(&row->chars[p], row->size - p, &cp);
+  return (len && p + len == cx) ? p : cx - 1;
 }
 
-/*** editor operations */
+// editorRowCharStart() moves cx back to the start of the character it is in.
+size_t editorRowCharStart(erow *row, size_t cx) {
+  for (size_t p = cx; p > 0 && cx - p < 3;) {
+    p--;
+    uint32_t cp;
+    int len = utf8Decode(&row->chars[p], row->size - p, &cp);
+    if (len > 1 && p + len > cx)
+      return p;
+  }
+  return cx;
+}
+
+// editorLayoutRow() walks chars and lays out the render: tabs become spaces,
+// valid multibyte characters are copied and invalid bytes become '?'. with
+// render and m set to NULL it only measures, so editorUpdateRow() can size
+// both buffers before a second pass fills them. pure ASCII stretches are
+// skipped with editorAsciiPrefix().
+void editorLayoutRow(erow *row, char *render, colmark *m, size_t *rsize,
+                     size_t *nmarks, int *copy) {
+  size_t j = 0, rb = 0, rx = 0, n = 0;
+  size_t runlen = 0;
+  // runlen is the length in bytes of the multibyte run being extended, 0
+  // when the previous character was not part of one.
+  *copy = 0;
+
+  while (j < row->size) {
+    size_t k = editorAsciiPrefix(&row->chars[j], row->size - j);
+    if (k) {
+      if (render)
+        memcpy(&render[rb], &row->chars[j], k);
+      j += k;
+      rb += k;
+      rx += k;
+      runlen = 0;
+      continue;
+    }
+
+    unsigned char c = row->chars[j];
+    uint32_t cp;
+    int len = c == '\t' ? 0 : utf8Decode(&row->chars[j], row->size - j, &cp);
+
+    if (c == '\t') {
+      size_t w = TEXT_EDITOR_TAB_STOP - rx % TEXT_EDITOR_TAB_STOP;
+      if (m) {
+        m[n].cx = j;
+        m[n].rx = rx;
+        m[n].rb = rb;
+        m[n].len = 1;
+        m[n].width = w;
+      }
+      if (render)
+        memset(&render[rb], ' ', w);
+      n++;
+      j++;
+      rb += w;
+      rx += w;
+      runlen = 0;
+      *copy = 1;
+    } else if (len == 0) {
+      if (render)
+        render[rb] = '?';
+      j++;
+      rb++;
+      rx++;
+      runlen = 0;
+      *copy = 1;
+    } else {
+      int w = editorCharWidth(cp);
+      if (runlen == 0 || runlen + len > 255) {
+        // start a new run, a mark's len has to fit in a byte.
+        if (m) {
+          m[n].cx = j;
+          m[n].rx = rx;
+          m[n].rb = rb;
+          m[n].len = 0;
+          m[n].width = 0;
+        }
+        n++;
+        runlen = 0;
+      }
+      if (m) {
+        m[n - 1].len += len;
+        m[n - 1].width += w;
+      }
+      runlen += len;
+      if (render)
+        memcpy(&render[rb], &row->chars[j], len);
+      j += len;
+      rb += len;
+      rx += w;
+    }
+  }
+  *rsize = rb;
+  *nmarks = n;
+}
+
+// editorUpdateRender() lays out render and cols from chars.
+void editorUpdateRender(erow *row) {
+  size_t rsize, nmarks;
+  int copy;
+
+  if (editorAsciiPrefix(row->chars, row->size) == row->size) {
+    // the common case: plain ASCII without tabs needs no layout at all.
+    rsize = row->size;
+    nmarks = 0;
+    copy = 0;
+  } else {
+    editorLayoutRow(row, NULL, NULL, &rsize, &nmarks, &copy);
+  }
+
+  size_t colsize = nmarks ? (nmarks + 1) * sizeof(colmark) : 0;
+  row->cols = rowRealloc(row->cols, editorColsSize(row->cols), colsize);
+
+  if (!copy) {
+    // render would be a byte-for-byte copy of chars, so point at chars
+    // instead of keeping a second copy.
+    if (!row->render_shared)
+      rowFree(row->render, row->rsize + 1);
+    row->render = row->chars;
+    row->render_shared = 1;
+  } else {
+    if (row->render_shared) {
+      row->render = NULL;
+      row->render_shared = 0;
+    }
+    row->render = rowRealloc(row->render, row->rsize + 1, rsize + 1);
+  }
+  row->rsize = rsize;
+
+  if (nmarks || copy) {
+    size_t n;
+    if (nmarks)
+      row->cols[0].cx = nmarks;
+    editorLayoutRow(row, copy ? row->render : NULL,
+                    nmarks ? row->cols + 1 : NULL, &rsize, &n, &copy);
+    row->render[rsize] = '\0';
+  }
+}
+
+void editorUpdateRow(erow *row) {
+  int64_t trace_start = TRACE_BEGIN();
+  struct longRow *lr = row->lr;
+  if (lr && lr->edited && lr->ascii_edit && row->render_shared &&
+      row->cols == NULL) {
+    // a long ASCII row that stayed ASCII, render is still just chars.
+    row->render = row->chars;
+    row->rsize = row->size;
+  } else {
+    editorUpdateRender(row);
+  }
+
+  if (row->size >= LONG_ROW_SIZE && row->lr == NULL) {
+    rowFree(row->hl, row->nhl * sizeof(hlspan));
+    row->hl = NULL;
+    row->nhl = 0;
+    row->lr = calloc(1, sizeof(struct longRow));
+    if (row->lr == NULL)
+      die("calloc");
+  } else if (row->size < LONG_ROW_SIZE && row->lr) {
+    longRowFree(row);
+  }
+
+  int64_t hl_start = TRACE_BEGIN();
+  if (E.hud.on) {
+    int64_t start = editorNow();
+    editorUpdateSyntax(row);
+    E.hud.hl_time += editorNow() - start;
+  } else {
+    editorUpdateSyntax(row);
+  }
+  TRACE_END("highlight", hl_start);
+  wordsCount(row);
+  TRACE_END("update row", trace_start);
+}
+
+// editorInitRow() sets up a new row holding s, without laying it out.
+void editorInitRow(erow *row, int64_t at, const char *s, size_t len) {
+  row->idx = at;
+
+  row->size = len;
+  row->chars = rowAlloc(len + 1);
+
+  memcpy(row->chars, s, len);
+  row->chars[len] = '\0';
+
+  row->rsize = 0;
+  row->render = NULL;
+  row->render_shared = 0;
+  row->hl = NULL;
+  row->nhl = 0;
+  row->cols = NULL;
+  row->lr = NULL;
+  row->hl_open_comment = 0;
+  row->words_counted = 0;
+}
+
+void editorInsertRow(int64_t at, char *s, size_t len) {
+
+  if (at < 0 || at > E.numrows)
+    return;
+  E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
+  memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numrows - at));
+  for(int64_t j = at + 1;j <= E.numrows;j++) E.row[j].idx++;  
+  symbolShift(at, 0, 1);
+  editorInitRow(&E.row[at], at, s, len);
+  E.row[at].hl_open_comment = editorRowOpenComment(at - 1);
+  // the row after starts where the one before ends, so editorUpdateSyntax()
+  // carries on to it when the new row ends anywhere else.
+  E.numrows++;
+  editorUpdateRow(&E.row[at]);
+  E.dirty++;
+}
+
+void editorFreeRow(erow *row) {
+  wordsForget(row);
+  if (!row->render_shared)
+    rowFree(row->render, row->rsize + 1);
+  rowFree(row->chars, row->size + 1);
+  rowFree(row->hl, row->nhl * sizeof(hlspan));
+  rowFree(row->cols, editorColsSize(row->cols));
+  // give the memory back to the slab free lists.
+  longRowFree(row);
+}
+
+// editorSpliceRows() frees del rows at at and makes room for ins new ones in
+// their place, moving the rows after them only once. the new rows are empty
+// and the caller fills them with editorInitRow().
+void editorSpliceRows(int64_t at, int64_t del, int64_t ins) {
+  editorUndoFree();
+  // the undo record refers to rows by index.
+  for (int64_t j = at; j < at + del; j++)
+    editorFreeRow(&E.row[j]);
+  int64_t n = E.numrows - del + ins;
+  if (ins > del)
+    E.row = realloc(E.row, sizeof(erow) * n);
+  memmove(&E.row[at + ins], &E.row[at + del],
+          sizeof(erow) * (E.numrows - at - del));
+  for (int64_t j = at + ins; j < n; j++)
+    E.row[j].idx = j;
+  E.numrows = n;
+  symbolShift(at, del, ins);
+  if (E.words.scan > at)
+    E.words.scan = at;
+}
+
+void editorDelRow(int64_t at) {
+  if (at < 0 || at >= E.numrows) {
+    return;
+  }
+  int open = editorRowOpenComment(at);
+  editorFreeRow(&E.row[at]);
+  memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at - 1));
+  for(int64_t j = at;j < E.numrows - 1;j++) E.row[j].idx--;
+  E.numrows--;
+  symbolShift(at, 1, 0);
+  if (E.words.scan > at)
+    E.words.scan = at;
+  // the rows moved up, the idle counting looks at them again.
+  if (at < E.numrows && editorRowOpenComment(at - 1) != open)
+    editorUpdateSyntax(&E.row[at]);
+  // the row after now starts where the one before the deleted row ends.
+  E.dirty++;
+}
+
+void editorRowInsertChar(erow *row, size_t at, int c) {
+  if (at > row->size) {
+    at = row->size;
+  }
+
+  wordsForget(row);
+  row->chars = rowRealloc(row->chars, row->size + 1, row->size + 2);
+  // rowRealloc() only moves the buffer when it outgrows its size class.
+  // the row->chars is the buffer.
+  // the row->size is the length of the buffer.
+
+  if (row->lr)
+    longRowEdit(row, at, 0, 1, c < 0x80 && c != '\t');
+  memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
+  // the memmove() function is used to copy memory from one location to another.
+  // the &row->chars[at + 1] is the destination.
+  // the &row->chars[at] is the source.
+  // the row->size - at + 1 is the number of bytes to copy.
+  row->size++;
+  row->chars[at] = c;
+  editorUpdateRow(row);
+  E.dirty++;
+}
+
+void editorRowAppendString(erow *row, char *s, size_t len) {
+  wordsForget(row);
+  if (row->lr)
+    longRowEdit(row, row->size, 0, len, editorAsciiPrefix(s, len) == len);
+  row->chars = rowRealloc(row->chars, row->size + 1, row->size + len + 1);
+  // we use rowRealloc() to allocate memory for the new string. which is the old
+  // size + the length of the new string + 1 for the null terminator.
+  memcpy(&row->chars[row->size], s, len);
+  row->size += len;
+  row->chars[row->size] = '\0';
+  editorUpdateRow(row);
+  E.dirty++;
+}
+
+void editorRowDelChar(erow *row, size_t at) {
+  if (at >= row->size)
+    return;
+  size_t n = editorRowNextChar(row, at) - at;
+  // n is the length of the whole UTF-8 character at the cursor.
+  wordsForget(row);
+  if (row->lr)
+    longRowEdit(row, at, n, 0, 1);
+  memmove(&row->chars[at], &row->chars[at + n], row->size - at - n + 1);
+  // the memmove() function is used to copy memory from one location to another.
+  // we are overwriting the character at the cursor with the characters after it.
+  // and then we are moving the rest of the characters to the left.
+  row->chars = rowRealloc(row->chars, row->size + 1, row->size - n + 1);
+  row->size -= n;
+  editorUpdateRow(row);
+  E.dirty++;
+}
+
+/*** paging */
+
+// files of TEXT_EDITOR_PAGE_THRESHOLD bytes or more are never read into E.row.
+// instead we scan them once and write the offset of every line start to an
+// index file on disk, which is then mmap()ed so the kernel can page it in and
+// out as needed. the text itself is read through a small LRU cache of
+// PAGER_CHUNK_SIZE chunks, and the erows built from it live in a direct-mapped
+// cache keyed by line number, so only the rows around the viewport and the
+// search cursor are ever materialized. paged files are read-only.
+//
+// the index file is kept in $XDG_CACHE_HOME/text_editor (~/.cache/text_editor)
+// under a hash of the path. it is reused when the file has the size and
+// mtime it was indexed at and the same bytes in a few sampled blocks, so an
+// unchanged file opens without reading it; a file that only grew has just
+// its new lines indexed. in idle time the file is also run through the
+// highlighter, and the multiline comment state at every
+// PAGER_CHECKPOINT_LINES'th line start is saved in the index header. a row
+// whose previous row is not materialized starts highlighting from there.
+// each time an index is opened its mtime is set to now, and old or least
+// recently used indexes are removed to keep the directory small. when the
+// cache index cannot be written, a full disk say, an unlinked one in
+// $TMPDIR is used instead.
+
+struct pagerChunk {
+  off_t off; // file offset of the chunk, -1 if the slot is empty.
+  size_t len;
+  unsigned long used; // tick of the last access, used for LRU eviction.
+  char *data;
+};
+
+// the index file starts with a pagerHeader followed by the checkpoint bits,
+// bit k being the comment state at the start of line k *
+// PAGER_CHECKPOINT_LINES, and the line offsets start at PAGER_INDEX_OFFSET.
+// magic is cleared while the index is being extended, so an index that was
+// left half written is never trusted.
+#define PAGER_MAGIC "TEIDX01\n"
+
+struct pagerHeader {
+  char magic[8];
+  int64_t size; // bytes of the file the index covers.
+  int64_t mtime_sec, mtime_nsec;
+  uint64_t sample; // pagerSample() of those bytes.
+  int64_t numlines;
+  int32_t at_line_start;
+  int32_t open;    // comment state at the start of line scanned.
+  int64_t scanned; // lines run through the highlighter so far.
+  char syntax[32]; // filetype the checkpoints were made with.
+};
+
+struct editorPager {
+  int fd;
+  off_t filesize;
+  int64_t numlines;
+  off_t *lineoff;
+  // lineoff[i] is where line i starts, lineoff[numlines] is the file size.
+  size_t indexlen;
+  int ifd;
+  int at_line_start;
+  // ifd is the index file, kept open so the index can grow with the file.
+  struct pagerHeader *hdr;
+  struct editorSyntax *syntax; // E.syntax the header was last checked with.
+  struct pagerChunk chunk[PAGER_CHUNKS];
+  unsigned long tick;
+  erow row[PAGER_ROWS];
+  int64_t rowline[PAGER_ROWS];
+  // rowline[slot] is the line cached in row[slot], -1 if the slot is empty.
+  char *line;
+  size_t linecap;
+};
+
+// editorHash() adds n bytes to an FNV-1a hash, which starts out as
+// HASH_INIT.
+#define HASH_INIT 14695981039346656037ULL
+uint64_t editorHash(uint64_t h, const char *s, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    h ^= (unsigned char)s[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+// pagerSample() hashes size and PAGER_SAMPLES blocks spread evenly over the
+// first size bytes of the file. it reads 64 KB however big the file is,
+// which is what lets an unchanged file be recognized without scanning it.
+uint64_t pagerSample(int fd, off_t size) {
+  char buf[4096];
+  uint64_t h = editorHash(HASH_INIT, (char *)&size, sizeof(size));
+  for (int k = 0; k < PAGER_SAMPLES; k++) {
+    size_t want = size < (off_t)sizeof(buf) ? (size_t)size : sizeof(buf);
+    off_t at = (size - (off_t)want) * k / (PAGER_SAMPLES - 1);
+    ssize_t n = pread(fd, buf, want, at);
+    if (n == -1)
+      return 0;
+    h = editorHash(h, buf, n);
+  }
+  return h;
+}
+
+// pagerExtendIndex() scans the file from where the index ends with large
+// read()s and memchr(), and appends the offsets of the new lines to the index
+// file, which is then mapped again.
+int pagerExtendIndex(struct editorPager *p) {
+  size_t bufsize = 1024 * 1024;
+  char *buf = malloc(bufsize);
+  size_t outcap = 64 * 1024, outlen = 0;
+  off_t *out = malloc(outcap * sizeof(off_t));
+  if (buf == NULL || out == NULL)
+    die("malloc");
+
+  // the mtime is taken first, a write during the scan makes it look older
+  // than the index and the next open checks the file again.
+  struct stat st;
+  if (fstat(p->fd, &st) == -1)
+    goto fail;
+  memset(p->hdr->magic, 0, sizeof(p->hdr->magic));
+  if (lseek(p->ifd, PAGER_INDEX_OFFSET + p->numlines * sizeof(off_t),
+            SEEK_SET) == -1)
+    goto fail;
+  // the new entries go over the old end of file entry.
+  int64_t numlines = p->numlines;
+  off_t pos = p->filesize;
+  int at_line_start = p->at_line_start;
+  ssize_t n;
+  while ((n = pread(p->fd, buf, bufsize, pos)) != 0) {
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      goto fail;
+    }
+    char *s = buf, *end = buf + n;
+    while (s < end) {
+      if (at_line_start) {
+        out[outlen++] = pos + (s - buf);
+        numlines++;
+        if (outlen == outcap) {
+          if (writeAll(p->ifd, (char *)out, outlen * sizeof(off_t)) == -1)
+            goto fail;
+          outlen = 0;
+        }
+        at_line_start = 0;
+      }
+      char *nl = memchr(s, '\n', end - s);
+      if (nl == NULL)
+        break;
+      s = nl + 1;
+      at_line_start = 1;
+    }
+    pos += n;
+  }
+  out[outlen++] = pos;
+  if (writeAll(p->ifd, (char *)out, outlen * sizeof(off_t)) == -1)
+    goto fail;
+  free(out);
+  free(buf);
+
+  if (p->lineoff)
+    munmap(p->lineoff, p->indexlen);
+  p->filesize = pos;
+  p->numlines = numlines;
+  p->at_line_start = at_line_start;
+  p->indexlen = (numlines + 1) * sizeof(off_t);
+  p->lineoff = mmap(NULL, p->indexlen, PROT_READ, MAP_SHARED, p->ifd,
+                    PAGER_INDEX_OFFSET);
+  if (p->lineoff == MAP_FAILED) {
+    p->lineoff = NULL;
+    return -1;
+  }
+
+  struct pagerHeader *h = p->hdr;
+  h->size = pos;
+  h->mtime_sec = st.st_mtim.tv_sec;
+  h->mtime_nsec = st.st_mtim.tv_nsec;
+  h->sample = pagerSample(p->fd, pos);
+  h->numlines = numlines;
+  h->at_line_start = at_line_start;
+  memcpy(h->magic, PAGER_MAGIC, sizeof(h->magic));
+  return 0;
+
+fail:
+  free(out);
+  free(buf);
+  return -1;
+}
+
+// pagerCacheDir() puts the cache directory in dir, which has room for
+// PATH_MAX bytes, creating it if needed. it returns -1 if there is none.
+int pagerCacheDir(char *dir) {
+  const char *xdg = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  if (xdg && xdg[0])
+    snprintf(dir, PATH_MAX, "%s", xdg);
+  else if (home && home[0])
+    snprintf(dir, PATH_MAX, "%s/.cache", home);
+  else
+    return -1;
+  mkdir(dir, 0700);
+  size_t len = strlen(dir);
+  snprintf(&dir[len], PATH_MAX - len, "/text_editor");
+  if (mkdir(dir, 0700) == -1 && errno != EEXIST)
+    return -1;
+  return 0;
+}
+
+// pagerCachePath() names the index file of filename in the cache directory.
+int pagerCachePath(const char *filename, char *path, size_t size) {
+  char dir[PATH_MAX];
+  if (pagerCacheDir(dir) == -1)
+    return -1;
+
+  char real[PATH_MAX];
+  const char *key = realpath(filename, real) ? real : filename;
+  uint64_t h = editorHash(HASH_INIT, key, strlen(key));
+  if ((size_t)snprintf(path, size, "%s/%016" PRIx64 ".idx", dir, h) >= size)
+    return -1;
+  return 0;
+}
+
+struct pagerCacheFile {
+  char name[32];
+  time_t used;
+  off_t size;
+};
+
+int pagerCacheOlder(const void *a, const void *b) {
+  const struct pagerCacheFile *x = a, *y = b;
+  return (x->used > y->used) - (x->used < y->used);
+}
+
+// pagerCachePrune() removes the indexes that were not used for
+// PAGER_CACHE_DAYS, then the least recently used ones until the rest fit in
+// PAGER_CACHE_MAX. indexes that are open, which are locked, are kept.
+void pagerCachePrune() {
+  char dir[PATH_MAX], path[PATH_MAX + 256];
+  if (pagerCacheDir(dir) == -1)
+    return;
+  DIR *d = opendir(dir);
+  if (d == NULL)
+    return;
+  struct pagerCacheFile *f = NULL;
+  int n = 0, cap = 0;
+  off_t total = 0;
+  struct dirent *de;
+  struct stat st;
+  while ((de = readdir(d)) != NULL) {
+    size_t len = strlen(de->d_name);
+    if (len >= sizeof(f->name) || len < 4 ||
+        strcmp(&de->d_name[len - 4], ".idx") != 0)
+      continue;
+    snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+    if (stat(path, &st) == -1 || !S_ISREG(st.st_mode))
+      continue;
+    if (n == cap) {
+      cap = cap ? cap * 2 : 64;
+      f = realloc(f, cap * sizeof(struct pagerCacheFile));
+      if (f == NULL)
+        die("realloc");
+    }
+    memcpy(f[n].name, de->d_name, len + 1);
+    f[n].used = st.st_mtime;
+    f[n].size = st.st_size;
+    total += st.st_size;
+    n++;
+  }
+  closedir(d);
+
+  qsort(f, n, sizeof(struct pagerCacheFile), pagerCacheOlder);
+  time_t old = time(NULL) - PAGER_CACHE_DAYS * 24 * 60 * 60;
+  for (int i = 0; i < n && (f[i].used < old || total > PAGER_CACHE_MAX);
+       i++) {
+    snprintf(path, sizeof(path), "%s/%s", dir, f[i].name);
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd == -1)
+      continue;
+    if (flock(fd, LOCK_EX | LOCK_NB) == 0 && unlink(path) == 0)
+      total -= f[i].size;
+    close(fd);
+  }
+  free(f);
+}
+
+// pagerCacheOpen() opens the cached index of filename and locks it. while
+// another editor has the same file open the lock is taken, and we fall back
+// to a private index rather than both extending one file.
+int pagerCacheOpen(const char *filename) {
+  char path[PATH_MAX + 64];
+  if (pagerCachePath(filename, path, sizeof(path)) == -1)
+    return -1;
+  int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd == -1)
+    return -1;
+  if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+    close(fd);
+    return -1;
+  }
+  futimens(fd, NULL);
+  // the mtime is when the index was last used, see pagerCachePrune().
+  pagerCachePrune();
+  return fd;
+}
+
+// pagerTempIndex() makes an unlinked temporary index file.
+int pagerTempIndex() {
+  const char *dir = getenv("TMPDIR");
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/text_editor-index-XXXXXX",
+           dir ? dir : "/var/tmp");
+  int fd = mkstemp(path);
+  if (fd == -1)
+    return -1;
+  unlink(path);
+  // the index lives on disk but has no name, so it goes away with the fd.
+  return fd;
+}
+
+// pagerIndexValid() tells whether the index in ifd still describes the
+// start of the file.
+int pagerIndexValid(struct editorPager *p) {
+  struct pagerHeader *h = p->hdr;
+  struct stat st, ist;
+  if (memcmp(h->magic, PAGER_MAGIC, sizeof(h->magic)) != 0)
+    return 0;
+  if (fstat(p->fd, &st) == -1 || fstat(p->ifd, &ist) == -1)
+    return 0;
+  if (h->numlines < 0 || h->size < 0 ||
+      ist.st_size < PAGER_INDEX_OFFSET +
+                        (off_t)((h->numlines + 1) * sizeof(off_t)))
+    return 0;
+  if (st.st_size < h->size)
+    return 0;
+  if (st.st_size == h->size && (st.st_mtim.tv_sec != h->mtime_sec ||
+                                st.st_mtim.tv_nsec != h->mtime_nsec))
+    return 0;
+  // a file that grew is reused as far as it was indexed, if those bytes
+  // look the same.
+  return pagerSample(p->fd, h->size) == h->sample;
+}
+
+// pagerUnloadIndex() unmaps and closes the index file, after pagerLoadIndex()
+// failed on it.
+void pagerUnloadIndex(struct editorPager *p) {
+  if (p->lineoff)
+    munmap(p->lineoff, p->indexlen);
+  if (p->hdr)
+    munmap(p->hdr, PAGER_INDEX_OFFSET);
+  close(p->ifd);
+  p->lineoff = NULL;
+  p->hdr = NULL;
+  p->ifd = -1;
+  p->indexlen = 0;
+  p->filesize = 0;
+  p->numlines = 0;
+}
+
+// pagerLoadIndex() maps the index file and picks up where the index in it
+// ends, or indexes the whole file when it is new or out of date.
+int pagerLoadIndex(struct editorPager *p) {
+  struct stat ist;
+  if (fstat(p->ifd, &ist) == -1)
+    return -1;
+  if (ist.st_size < PAGER_INDEX_OFFSET &&
+      ftruncate(p->ifd, PAGER_INDEX_OFFSET) == -1)
+    return -1;
+  p->hdr = mmap(NULL, PAGER_INDEX_OFFSET, PROT_READ | PROT_WRITE, MAP_SHARED,
+                p->ifd, 0);
+  if (p->hdr == MAP_FAILED) {
+    p->hdr = NULL;
+    return -1;
+  }
+
+  if (pagerIndexValid(p)) {
+    p->filesize = p->hdr->size;
+    p->numlines = p->hdr->numlines;
+    p->at_line_start = p->hdr->at_line_start;
+  } else {
+    memset(p->hdr, 0, sizeof(struct pagerHeader));
+    if (ftruncate(p->ifd, PAGER_INDEX_OFFSET) == -1)
+      return -1;
+    p->at_line_start = 1;
+  }
+  return pagerExtendIndex(p);
+}
+
+// pagerGrow() picks up lines appended to the file since it was indexed.
+int pagerGrow(struct editorPager *p) {
+  off_t oldsize = p->filesize;
+  int64_t last = p->numlines - 1;
+  if (pagerExtendIndex(p) == -1)
+    return -1;
+  if (p->filesize == oldsize)
+    return 0;
+  // the chunk that held the old end of file and the row of the old last
+  // line may both be short now.
+  for (int j = 0; j < PAGER_CHUNKS; j++) {
+    struct pagerChunk *c = &p->chunk[j];
+    if (c->off != -1 && c->off + (off_t)c->len >= oldsize) {
+      c->off = -1;
+      c->used = 0;
+    }
+  }
+  if (last >= 0 && p->rowline[last % PAGER_ROWS] == last) {
+    editorFreeRow(&p->row[last % PAGER_ROWS]);
+    p->rowline[last % PAGER_ROWS] = -1;
+  }
+  return 0;
+}
+
+struct pagerChunk *pagerChunkAt(struct editorPager *p, off_t off) {
+  off_t base = off - off % PAGER_CHUNK_SIZE;
+  struct pagerChunk *victim = &p->chunk[0];
+  p->tick++;
+
+  for (int j = 0; j < PAGER_CHUNKS; j++) {
+    struct pagerChunk *c = &p->chunk[j];
+    if (c->off == base) {
+      c->used = p->tick;
+      return c;
+    }
+    if (c->used < victim->used)
+      victim = c;
+  }
+
+  if (victim->data == NULL && (victim->data = malloc(PAGER_CHUNK_SIZE)) == NULL)
+    die("malloc");
+  ssize_t n = pread(p->fd, victim->data, PAGER_CHUNK_SIZE, base);
+  if (n == -1) {
+    if (!E.session)
+      die("pread");
+    // a server shows the rows as cut short and tries again next time.
+    victim->off = -1;
+    victim->len = 0;
+    return victim;
+  }
+  victim->off = base;
+  victim->len = n;
+  victim->used = p->tick;
+  return victim;
+}
+
+// pagerCopyLine() copies the bytes of a line, without its line ending, into
+// dst which must have room for the whole raw line plus a '\0'. it returns the
+// length of the copied line.
+size_t pagerCopyLine(struct editorPager *p, int64_t line, char *dst) {
+  off_t start = p->lineoff[line];
+  size_t n = p->lineoff[line + 1] - start;
+  size_t got = 0;
+
+  if (n > PAGER_CHUNK_SIZE * 4) {
+    // long lines would only flush the chunk cache, read them directly.
+    while (got < n) {
+      ssize_t r = pread(p->fd, &dst[got], n - got, start + got);
+      if (r == -1 && errno == EINTR)
+        continue;
+      if (r <= 0)
+        break;
+      got += r;
+    }
+  }
+
+  while (got < n) {
+    struct pagerChunk *c = pagerChunkAt(p, start + got);
+    size_t from = start + got - c->off;
+    if (from >= c->len)
+      break;
+    // the file got shorter under us, return what is left.
+    size_t take = c->len - from;
+    if (take > n - got)
+      take = n - got;
+    memcpy(&dst[got], &c->data[from], take);
+    got += take;
+  }
+
+  while (got > 0 && (dst[got - 1] == '\n' || dst[got - 1] == '\r'))
+    got--;
+  dst[got] = '\0';
+  return got;
+}
+
+size_t pagerRawLineLen(struct editorPager *p, int64_t line) {
+  return p->lineoff[line + 1] - p->lineoff[line];
+}
+
+// pagerReadLine() is pagerCopyLine() into a scratch buffer that is only valid
+// until the next call.
+char *pagerReadLine(struct editorPager *p, int64_t line, size_t *len) {
+  size_t n = pagerRawLineLen(p, line);
+  if (n + 1 > p->linecap) {
+    p->linecap = n + 1;
+    p->line = realloc(p->line, p->linecap);
+    if (p->line == NULL)
+      die("realloc");
+  }
+  *len = pagerCopyLine(p, line, p->line);
+  return p->line;
+}
+
+// pagerSyncSyntax() forgets the comment states if they were worked out
+// for a different filetype than the current one.
+void pagerSyncSyntax(struct editorPager *p) {
+  if (p->syntax == E.syntax)
+    return;
+  p->syntax = E.syntax;
+  const char *name = E.syntax ? E.syntax->filetype : "";
+  struct pagerHeader *h = p->hdr;
+  if (strncmp(h->syntax, name, sizeof(h->syntax)) != 0) {
+    h->scanned = 0;
+    h->open = 0;
+    strncpy(h->syntax, name, sizeof(h->syntax));
+  }
+}
+
+// pagerCommentAt() returns the comment state at the start of line, or -1
+// when it has not been worked out yet.
+int pagerCommentAt(struct editorPager *p, int64_t line) {
+  pagerSyncSyntax(p);
+  struct pagerHeader *h = p->hdr;
+  if (E.syntax == NULL)
+    return 0;
+  if (line == h->scanned)
+    return h->open;
+  if (line > h->scanned || line % PAGER_CHECKPOINT_LINES)
+    return -1;
+  int64_t k = line / PAGER_CHECKPOINT_LINES;
+  unsigned char *bits = (unsigned char *)(h + 1);
+  return (bits[k / 8] >> (k % 8)) & 1;
+}
+
+// pagerScanComments() runs the lines after the last one scanned through the
+// highlighter for about budget nanoseconds, saving the comment state every
+// PAGER_CHECKPOINT_LINES lines. the last line is left alone as it may still
+// grow. like long rows, lines are highlighted on chars.
+void pagerScanComments(struct editorPager *p, int64_t budget) {
+  pagerSyncSyntax(p);
+  struct pagerHeader *h = p->hdr;
+  if (E.syntax == NULL)
+    return;
+  unsigned char *bits = (unsigned char *)(h + 1);
+  int64_t cap = (int64_t)(PAGER_INDEX_OFFSET - sizeof(struct pagerHeader)) *
+                8 * PAGER_CHECKPOINT_LINES;
+  int64_t end = p->numlines - 1 < cap ? p->numlines - 1 : cap;
+  int64_t deadline = editorNow() + budget;
+  unsigned char *hl = editorHlScratch(LONG_ROW_CHUNK + HL_SLACK);
+
+  while (h->scanned < end && editorNow() < deadline) {
+    int64_t line = h->scanned;
+    if (line % PAGER_CHECKPOINT_LINES == 0) {
+      int64_t k = line / PAGER_CHECKPOINT_LINES;
+      if (h->open)
+        bits[k / 8] |= 1 << (k % 8);
+      else
+        bits[k / 8] &= ~(1 << (k % 8));
+    }
+    size_t len;
+    char *s = pagerReadLine(p, line, &len);
+    struct hlState st = {0, h->open, 1, 0, HL_NORMAL};
+    size_t i = 0;
+    while (i < len) {
+      size_t to = len - i < LONG_ROW_CHUNK ? len - i : LONG_ROW_CHUNK;
+      i += editorHighlight(&s[i], len - i, to, &st, hl, NULL);
+    }
+    h->open = st.in_comment;
+    h->scanned++;
+  }
+}
+
+erow *pagerRow(struct editorPager *p, int64_t at) {
+  int slot = at % PAGER_ROWS;
+  erow *row = &p->row[slot];
+  if (p->rowline[slot] == at)
+    return row;
+
+  // the comment state a row starts in comes from the row before it. when
+  // that is not materialized, read the rows from the checkpoint before.
+  if (at > 0 && p->rowline[(at - 1) % PAGER_ROWS] != at - 1 &&
+      pagerCommentAt(p, at) == -1) {
+    int64_t from = at - at % PAGER_CHECKPOINT_LINES;
+    if (pagerCommentAt(p, from) != -1) {
+      for (int64_t j = from; j < at; j++)
+        pagerRow(p, j);
+    }
+  }
+
+  if (p->rowline[slot] != -1)
+    editorFreeRow(row);
+
+  // read straight into the row so a long line is only held in memory once.
+  size_t raw = pagerRawLineLen(p, at);
+  row->chars = rowAlloc(raw + 1);
+  size_t len = pagerCopyLine(p, at, row->chars);
+  row->chars = rowRealloc(row->chars, raw + 1, len + 1);
+  row->idx = at;
+  row->size = len;
+  row->rsize = 0;
+  row->render = NULL;
+  row->render_shared = 0;
+  row->hl = NULL;
+  row->nhl = 0;
+  row->cols = NULL;
+  row->lr = NULL;
+  row->hl_open_comment = 0;
+  row->words_counted = 0;
+  p->rowline[slot] = at;
+  editorUpdateRow(row);
+  return row;
+}
+
+// pagerOpen() indexes filename for paging. it returns NULL with errno set
+// when the file cannot be read or indexed.
+struct editorPager *pagerOpen(const char *filename) {
+  struct editorPager *p = calloc(1, sizeof(struct editorPager));
+  if (p == NULL)
+    die("calloc");
+  p->fd = open(filename, O_RDONLY);
+  p->ifd = p->fd == -1 ? -1 : pagerCacheOpen(filename);
+  if (p->ifd != -1 && pagerLoadIndex(p) == -1) {
+    // most likely a full disk, give the space back and index privately.
+    ftruncate(p->ifd, 0);
+    pagerUnloadIndex(p);
+  }
+  if (p->fd != -1 && p->ifd == -1)
+    p->ifd = pagerTempIndex();
+  if (p->ifd == -1 || pagerLoadIndex(p) == -1) {
+    int err = errno;
+    if (p->ifd != -1)
+      pagerUnloadIndex(p);
+    if (p->fd != -1)
+      close(p->fd);
+    free(p);
+    errno = err;
+    return NULL;
+  }
+  for (int j = 0; j < PAGER_CHUNKS; j++)
+    p->chunk[j].off = -1;
+  for (int j = 0; j < PAGER_ROWS; j++)
+    p->rowline[j] = -1;
+  return p;
+}
+
+void pagerClose(struct editorPager *p) {
+  for (int j = 0; j < PAGER_ROWS; j++) {
+    if (p->rowline[j] != -1)
+      editorFreeRow(&p->row[j]);
+  }
+  for (int j = 0; j < PAGER_CHUNKS; j++)
+    free(p->chunk[j].data);
+  munmap(p->lineoff, p->indexlen);
+  munmap(p->hdr, PAGER_INDEX_OFFSET);
+  close(p->ifd);
+  close(p->fd);
+  free(p->line);
+  free(p);
+}
+
+// editorRow() returns row 'at' of the document, reading it in from disk when
+// in paging mode. the pointer is only good until the next editorRow() call
+// for a line that maps to the same cache slot.
+erow *editorRow(int64_t at) {
+  if (E.pager)
+    return pagerRow(E.pager, at);
+  return &E.row[at];
+}
+
+// editorCachedRow() is like editorRow() but never touches the disk. it returns
+// NULL when the row does not exist or is not currently materialized.
+erow *editorCachedRow(int64_t at) {
+  if (at < 0 || at >= E.numrows)
+    return NULL;
+  if (E.pager) {
+    int slot = at % PAGER_ROWS;
+    return E.pager->rowline[slot] == at ? &E.pager->row[slot] : NULL;
+  }
+  return &E.row[at];
+}
+
+/*** editor operations */
 
 void editorInsertChars(int c) {
   if (E.cy == E.numrows) {
@@ -658,219 +2843,3049 @@ void editorInsertChars(int c) {
     // if both are equal, we append a new row.
     editorInsertRow(E.numrows, "", 0);
   }
-  editorRowInsertChar(&E.row[E.cy], E.cx, c);
-  E.cx++;
+  editorRowInsertChar(&E.row[E.cy], E.cx, c);
+  E.cx++;
+}
+
+void editorInsertNewline() {
+  if (E.cx == 0) {
+    editorInsertRow(E.cy, "", 0);
+  } else {
+    erow *row = &E.row[E.cy];
+    editorInsertRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
+    row = &E.row[E.cy];
+    wordsForget(row);
+    if (row->lr)
+      longRowEdit(row, E.cx, row->size - E.cx, 0, 1);
+    row->chars = rowRealloc(row->chars, row->size + 1, E.cx + 1);
+    row->size = E.cx;
+    row->chars[row->size] = '\0';
+    // the '\0' character is used to terminate the string.
+    editorUpdateRow(row);
+  }
+
+  E.cy++;
+  E.cx = 0;
+}
+
+void editorDelChar() {
+  if (E.cy == E.numrows)
+    return;
+  if (E.cx == 0 && E.cy == 0) {
+    return;
+  }
+  erow *row = &E.row[E.cy];
+  if (E.cx > 0) {
+    E.cx = editorRowPrevChar(row, E.cx);
+    editorRowDelChar(row, E.cx);
+  } else {
+    E.cx = E.row[E.cy - 1].size;
+    editorRowAppendString(&E.row[E.cy - 1], row->chars, row->size);
+    editorDelRow(E.cy);
+    E.cy--;
+  }
+}
+/*** file i/o */
+
+char *editorRowsString(size_t *buflen) {
+  size_t totlen = 0;
+  int64_t j;
+  for (j = 0; j < E.numrows; j++) {
+    totlen += E.row[j].size + 1;
+  }
+  *buflen = totlen;
+
+  char *buf = malloc(totlen);
+  if (buf == NULL && totlen > 0)
+    return NULL;
+  char *p = buf;
+
+  for (j = 0; j < E.numrows; j++) {
+    memcpy(p, E.row[j].chars, E.row[j].size);
+    p += E.row[j].size;
+    *p = '\n';
+    p++;
+  }
+
+  return buf;
+}
+
+// editorFreeRows() closes the current document. rows that fit in a slab
+// class are released together with their blocks instead of one by one.
+void editorFreeRows() {
+  if (E.pager) {
+    pagerClose(E.pager);
+    E.pager = NULL;
+  }
+  if (E.hex) {
+    hexClose(E.hex);
+    E.hex = NULL;
+  }
+  for (int64_t j = 0; j < E.numrows && E.row; j++) {
+    erow *row = &E.row[j];
+    wordsForget(row);
+    if (row->size + 1 > SLAB_MAX_SIZE)
+      free(row->chars);
+    if (!row->render_shared && row->rsize + 1 > SLAB_MAX_SIZE)
+      free(row->render);
+    if (row->nhl * sizeof(hlspan) > SLAB_MAX_SIZE)
+      free(row->hl);
+    if (editorColsSize(row->cols) > SLAB_MAX_SIZE)
+      free(row->cols);
+    longRowFree(row);
+  }
+  free(E.row);
+  E.row = NULL;
+  E.numrows = 0;
+  slabFreeAll(&E.slab);
+  symbolReset();
+  E.words.scan = 0;
+}
+
+// editorOpenFailed() gives up on reading the current file. outside a server
+// session that ends the editor, a server keeps the empty buffer instead since
+// its other buffers may hold unsaved edits.
+void editorOpenFailed(const char *s) {
+  if (!E.session)
+    die(s);
+  editorSetStatusMessage("Can't open file: %s", strerror(errno));
+}
+
+// editorOpenView() opens filename in hex view if hex is 1, as text if it is
+// 0, and in hex view only if it looks binary if it is HEX_AUTO.
+void editorOpenView(char *filename, int hex) {
+  editorFreeRows();
+  editorUndoFree();
+  editorStreamClose(1);
+  E.stream.comp = NULL;
+  free(E.filename);
+  E.filename = strdup(filename);
+
+  editorSelectSyntaxHighlight();
+  // strdup() is used to duplicate a string.
+  editorFileIdOf(filename, &E.disk);
+  int fd = open(filename, O_RDONLY);
+  struct editorCompressor *comp =
+      fd != -1 && hex != 1 ? editorCompressorOf(fd) : NULL;
+  if (fd != -1 && comp == NULL &&
+      (hex == 1 || (hex == HEX_AUTO && hexIsBinary(fd))) &&
+      (E.hex = hexOpen(fd)) != NULL) {
+    // nothing is read until it is drawn, see the hex view section.
+    E.dirty = 0;
+    E.follow.partial = 0;
+    E.follow.dropped = 0;
+    return;
+  }
+  if (comp) {
+    // read in the background, see the compressed files section.
+    editorOpenCompressed(fd, comp);
+    E.dirty = 0;
+    E.follow.partial = 0;
+    E.follow.dropped = 0;
+    return;
+  }
+  if (fd != -1)
+    close(fd);
+  struct stat st;
+  if (stat(filename, &st) == 0 && S_ISREG(st.st_mode) &&
+      st.st_size >= TEXT_EDITOR_PAGE_THRESHOLD) {
+    // too big to hold in memory, only index it and read rows on demand.
+    E.pager = pagerOpen(filename);
+    if (E.pager == NULL) {
+      editorOpenFailed("pagerOpen");
+      E.dirty = 0;
+      return;
+    }
+    E.numrows = E.pager->numlines;
+    E.dirty = 0;
+    E.disk.size = E.pager->filesize;
+    editorFollowSync();
+    return;
+  }
+
+  FILE *fp = fopen(filename, "r");
+  if (!fp) {
+    // a file that does not exist yet is a new, empty one.
+    if (errno != ENOENT)
+      editorOpenFailed("fopen");
+    E.dirty = 0;
+    E.disk.size = 0;
+    editorFollowSync();
+    return;
+  }
+  char *line = NULL;
+  size_t linecap = 0;
+  ssize_t linelen;
+  off_t nread = 0;
+  int crlf = 0;
+
+  while ((linelen = getline(&line, &linecap, fp)) != -1) {
+    nread += linelen;
+    if (nread == linelen)
+      crlf = linelen >= 2 && line[linelen - 2] == '\r' &&
+             line[linelen - 1] == '\n';
+    while (linelen > 0 &&
+           (line[linelen - 1] == '\n' || line[linelen - 1] == '\r')) {
+      linelen--;
+    }
+    editorInsertRow(E.numrows, line, linelen);
+  }
+  free(line);
+  fclose(fp);
+  E.dirty = 0;
+  E.disk.size = nread;
+  E.disk.crlf = crlf;
+  // the file may have grown while it was read, which the next check for
+  // changes on disk then picks up.
+  editorFollowSync();
+}
+
+void editorOpen(char *filename) { editorOpenView(filename, HEX_AUTO); }
+
+void editorSave() {
+  if (E.hex) {
+    hexSave();
+    return;
+  }
+  if (E.pager) {
+    editorSetStatusMessage("Read-only: file is opened in paging mode");
+    return;
+  }
+  if (E.follow.dropped) {
+    editorSetStatusMessage("Read-only: lines were dropped from the top in "
+                           "follow mode");
+    return;
+  }
+  if (E.stream.fd != -1) {
+    editorSetStatusMessage("Can't save before the whole file is read");
+    return;
+  }
+
+  if (E.filename == NULL) {
+    E.filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
+    if (E.filename == NULL) {
+      editorSetStatusMessage("Save aborted");
+      return;
+    }
+    editorSelectSyntaxHighlight();
+    E.stream.comp = editorCompressorFor(E.filename);
+    // a new name ending in .gz or .zst is written compressed.
+  }
+  struct editorCompressor *comp = E.stream.comp;
+
+  size_t len;
+  char *buf = editorRowsString(&len);
+  if (buf == NULL && len > 0) {
+    editorSetStatusMessage("Can't save! Out of memory");
+    return;
+  }
+
+  int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
+
+  // open is a system call that opens a file.
+  // the O_RDWR flag is used to open the file for reading and writing.
+  // the O_CREAT flag is used to create the file if it does not exist.
+  // the 0644 is the file permissions.
+  // which is read and write for the user, and read for the group and others.
+
+  if (fd != -1) {
+    // ftruncate() is used to truncate a file to a specified length.
+    // the fd is the file descriptor.
+    // len is the length of the file.
+    if (ftruncate(fd, comp ? 0 : len) != -1) {
+      // write() is used to write to a file.
+      // the fd is the file descriptor.
+      // the buf is the buffer of data.
+      // the len is the length of the data.
+
+      if ((comp ? editorWriteCompressed(comp, fd, buf, len)
+                : writeAll(fd, buf, len)) == 0) {
+        close(fd);
+        free(buf);
+        E.dirty = 0;
+        editorFileIdOf(E.filename, &E.disk);
+        editorSetStatusMessage("%zu bytes written to disk%s%s%s", len,
+                               comp ? " (" : "", comp ? comp->name : "",
+                               comp ? ")" : "");
+        return;
+      }
+    }
+    close(fd);
+  }
+  free(buf);
+  editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+}
+
+/*** hex view */
+
+// a file with a NUL byte in its first HEX_SNIFF bytes, or any file after
+// Ctrl-X or --hex, is shown as a hex dump instead of rows: offset, hex bytes
+// and ASCII on each line. the file is mmap()ed privately and nothing is read
+// or laid out until it is drawn, so opening is instant at any size. typing
+// over bytes changes them in the private mapping, whose pages are copied on
+// the first write, and their offsets are kept sorted in edits so that saving
+// pwrite()s just the changed runs in place. the file never changes size.
+
+struct editorHex {
+  int fd;
+  unsigned char *map;
+  size_t maplen; // size when it was mapped, size drops if the file shrinks.
+  off_t size;
+  off_t *edits; // offsets of the changed bytes, sorted.
+  size_t nedits, editcap;
+  off_t cur, top; // the byte under the cursor and the first one on screen.
+  int low;   // the next hex digit goes into the low nibble of cur.
+  int ascii; // the cursor is in the ASCII column, Tab switches.
+};
+
+// hexIsBinary() looks for a NUL byte at the start of a regular file.
+int hexIsBinary(int fd) {
+  char buf[HEX_SNIFF];
+  struct stat st;
+  if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))
+    return 0;
+  ssize_t n = pread(fd, buf, sizeof(buf), 0);
+  return n > 0 && memchr(buf, '\0', n) != NULL;
+}
+
+// hexOpen() maps the file open on fd, which it keeps when it succeeds. it
+// returns NULL if fd is not a regular file that can be mapped.
+struct editorHex *hexOpen(int fd) {
+  struct stat st;
+  if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))
+    return NULL;
+  struct editorHex *h = calloc(1, sizeof(struct editorHex));
+  if (h == NULL)
+    die("calloc");
+  h->fd = fd;
+  h->size = st.st_size;
+  if (h->size > 0) {
+    h->map = mmap(NULL, h->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (h->map == MAP_FAILED) {
+      free(h);
+      return NULL;
+    }
+    h->maplen = h->size;
+  }
+  return h;
+}
+
+void hexClose(struct editorHex *h) {
+  if (h->map)
+    munmap(h->map, h->maplen);
+  close(h->fd);
+  free(h->edits);
+  free(h);
+}
+
+// hexDigits() is how many hex digits an offset is shown with.
+int hexDigits(struct editorHex *h) {
+  int digits = 8;
+  uint64_t last = h->size > 0 ? (uint64_t)(h->size - 1) : 0;
+  while (digits < 16 && last >> (digits * 4))
+    digits += 4;
+  return digits;
+}
+
+// hexAsciiCol() is the screen column the ASCII column starts at, when
+// width bytes go on a line. the hex bytes are grouped by eight.
+int hexAsciiCol(struct editorHex *h, int width) {
+  return hexDigits(h) + 2 + width * 3 + width / 8 + (width % 8 != 0);
+}
+
+// hexWidth(h) is the number of bytes per line: 16, or fewer on a narrow
+// screen.
+int hexWidth(struct editorHex *h) {
+  int width = 16;
+  while (width > 1 && hexAsciiCol(h, width) + width > E.screencols)
+    width /= 2;
+  return width;
+}
+
+// hexEdited() returns the index of the first edit at or after off.
+size_t hexEdited(struct editorHex *h, off_t off) {
+  size_t lo = 0, hi = h->nedits;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (h->edits[mid] < off)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+void hexSetByte(struct editorHex *h, off_t off, unsigned char c) {
+  size_t at = hexEdited(h, off);
+  if (at == h->nedits || h->edits[at] != off) {
+    if (h->nedits == h->editcap) {
+      h->editcap = h->editcap ? h->editcap * 2 : 64;
+      h->edits = realloc(h->edits, h->editcap * sizeof(off_t));
+      if (h->edits == NULL)
+        die("realloc");
+    }
+    memmove(&h->edits[at + 1], &h->edits[at],
+            (h->nedits - at) * sizeof(off_t));
+    h->edits[at] = off;
+    h->nedits++;
+  }
+  h->map[off] = c;
+  E.dirty++;
+}
+
+// hexSave() writes each run of changed bytes back where it came from.
+void hexSave() {
+  struct editorHex *h = E.hex;
+  int fd = open(E.filename, O_WRONLY);
+  if (fd == -1) {
+    editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+    return;
+  }
+  size_t nwrites = 0;
+  for (size_t i = 0; i < h->nedits;) {
+    size_t j = i + 1;
+    while (j < h->nedits && h->edits[j] == h->edits[j - 1] + 1)
+      j++;
+    off_t off = h->edits[i];
+    size_t len = j - i, done = 0;
+    while (done < len) {
+      ssize_t n = pwrite(fd, &h->map[off + done], len - done, off + done);
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n <= 0) {
+        editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+        close(fd);
+        return;
+      }
+      done += n;
+    }
+    nwrites++;
+    i = j;
+  }
+  close(fd);
+  editorSetStatusMessage("%zu bytes written to disk in %zu writes", h->nedits,
+                         nwrites);
+  h->nedits = 0;
+  E.dirty = 0;
+  editorFileIdOf(E.filename, &E.disk);
+}
+
+// hexScroll() keeps the cursor line on screen. it also notices the file
+// getting shorter, as touching a mapped page past the end of file would
+// kill us, until editorCheckDisk() reads it again.
+void hexScroll() {
+  struct editorHex *h = E.hex;
+  struct stat st;
+  if (fstat(h->fd, &st) == 0 && st.st_size < h->size) {
+    h->size = st.st_size;
+    while (h->nedits > 0 && h->edits[h->nedits - 1] >= h->size)
+      h->nedits--;
+  }
+  if (h->cur >= h->size)
+    h->cur = h->size > 0 ? h->size - 1 : 0;
+
+  int width = hexWidth(h);
+  off_t line = h->cur - h->cur % width;
+  h->top -= h->top % width;
+  if (line < h->top)
+    h->top = line;
+  if (line >= h->top + (off_t)E.screenrows * width)
+    h->top = line - (off_t)(E.screenrows - 1) * width;
+}
+
+// hexCursor() is where the cursor goes on screen.
+void hexCursor(int *y, int *x) {
+  struct editorHex *h = E.hex;
+  int width = hexWidth(h);
+  int col = h->cur % width;
+  *y = (h->cur - h->top) / width;
+  if (h->ascii)
+    *x = hexAsciiCol(h, width) + col;
+  else
+    *x = hexDigits(h) + 2 + col * 3 + col / 8 + h->low;
+}
+
+// hexGoto() takes a decimal or 0x offset, or a percentage of the file.
+void hexGoto() {
+  char *answer =
+      editorPrompt("Go to offset: %s (1234, 0x4d2 or 45%%; ESC to cancel)",
+                   NULL);
+  if (answer == NULL)
+    return;
+  char *end;
+  errno = 0;
+  int base = answer[0] == '0' && (answer[1] == 'x' || answer[1] == 'X') ? 16
+                                                                         : 10;
+  long long n = strtoll(answer, &end, base);
+  if (errno || end == answer || n < 0 || (*end && strcmp(end, "%"))) {
+    editorSetStatusMessage("Can't go to %.40s", answer);
+    free(answer);
+    return;
+  }
+  struct editorHex *h = E.hex;
+  if (*end == '%')
+    n = h->size > 0 ? (h->size - 1) * (n > 100 ? 100 : n) / 100 : 0;
+  h->cur = n < h->size ? n : (h->size > 0 ? h->size - 1 : 0);
+  h->low = 0;
+  int width = hexWidth(h);
+  // the target goes in the middle of the screen.
+  off_t line = h->cur - h->cur % width;
+  off_t above = (off_t)(E.screenrows / 2) * width;
+  h->top = line > above ? line - above : 0;
+  free(answer);
+}
+
+int hexDigit(int c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+// hexHandleKey() handles the keys that mean something else in hex view. it
+// returns 0 for the ones editorHandleKey() should handle as usual.
+int hexHandleKey(int c) {
+  struct editorHex *h = E.hex;
+  int width = hexWidth(h);
+  off_t last = h->size > 0 ? h->size - 1 : 0;
+  off_t page = (off_t)E.screenrows * width;
+
+  switch (c) {
+  case Arrow_Left:
+  case Back_Space:
+  case CTRL_KEY('h'):
+    // after the high nibble, the first step back is to the same byte.
+    if (!h->low && h->cur > 0)
+      h->cur--;
+    break;
+  case Arrow_Right:
+    if (h->cur < last)
+      h->cur++;
+    break;
+  case Arrow_Up:
+    if (h->cur >= width)
+      h->cur -= width;
+    break;
+  case Arrow_Down:
+    h->cur = h->cur + width <= last ? h->cur + width : last;
+    break;
+  case Page_Up:
+    h->cur = h->cur > page ? h->cur - page : h->cur % width;
+    break;
+  case Page_Down:
+    h->cur = h->cur + page <= last ? h->cur + page : last;
+    break;
+  case HOME_KEY:
+    h->cur -= h->cur % width;
+    break;
+  case END_KEY:
+    h->cur = h->cur - h->cur % width + width - 1;
+    if (h->cur > last)
+      h->cur = last;
+    break;
+  case '\t':
+    h->ascii = !h->ascii;
+    break;
+  case CTRL_KEY('g'):
+    hexGoto();
+    break;
+  case CTRL_KEY('f'):
+  case CTRL_KEY('r'):
+  case CTRL_KEY('e'):
+  case CTRL_KEY('w'):
+  case CTRL_KEY('z'):
+    editorSetStatusMessage("Not in hex view, Ctrl-X goes back to text");
+    break;
+  case CTRL_KEY('q'):
+  case CTRL_KEY('s'):
+  case CTRL_KEY('n'):
+  case CTRL_KEY('b'):
+  case CTRL_KEY('p'):
+  case CTRL_KEY('t'):
+  case CTRL_KEY('x'):
+    return 0;
+  default:
+    if (c < 0x20 || c >= 0x7f)
+      break;
+    if (h->size == 0)
+      break;
+    if (h->ascii) {
+      hexSetByte(h, h->cur, c);
+      if (h->cur < last)
+        h->cur++;
+      break;
+    }
+    int d = hexDigit(c);
+    if (d == -1)
+      break;
+    unsigned char b = h->map[h->cur];
+    if (!h->low) {
+      hexSetByte(h, h->cur, (b & 0x0f) | d << 4);
+      h->low = 1;
+      return 1;
+    }
+    hexSetByte(h, h->cur, (b & 0xf0) | d);
+    if (h->cur < last)
+      h->cur++;
+    break;
+  }
+  h->low = 0;
+  return 1;
+}
+
+// editorToggleHex() opens the current file again in the other view.
+void editorToggleHex() {
+  if (E.filename == NULL || E.stream.fd != -1 || E.follow.on) {
+    editorSetStatusMessage("Hex view needs a file that is not being read or "
+                           "followed");
+    return;
+  }
+  if (E.dirty) {
+    editorSetStatusMessage("Save your changes before switching views");
+    return;
+  }
+  int hex = E.hex == NULL;
+  char *filename = strdup(E.filename);
+  editorOpenView(filename, hex);
+  free(filename);
+  E.cx = 0;
+  E.cy = 0;
+  E.rowoff = 0;
+  E.coloff = 0;
+  E.wrapoff = 0;
+  if (hex && E.hex == NULL)
+    editorSetStatusMessage("Can't show %.40s in hex", E.filename);
+}
+
+/*** buffers */
+
+// every file on the command line gets a buffer. the current buffer lives in
+// E as before; switching copies its part of E out to its editorBuffer and
+// the other buffer's in. a buffer is only read from disk the first time it
+// is switched to. when the render and highlight data of background buffers
+// add up to more than E.cache_cap, the least recently shown ones drop it and
+// rebuild it when they are shown again.
+
+struct editorBuffer {
+  int loaded;   // the file was read, or is open in paging mode.
+  int stale;    // render and highlighting were evicted.
+  unsigned long used; // tick of the last time the buffer was shown.
+  size_t cache; // bytes of render and highlighting, while in the background.
+  char *filename;
+  size_t cx, rx, coloff, wrapoff;
+  int64_t cy, rowoff, numrows;
+  erow *row;
+  int dirty;
+  struct editorSyntax *syntax;
+  struct editorPager *pager;
+  struct editorHex *hex;
+  struct editorFileId disk;
+  struct editorFollow follow;
+  struct editorStream stream;
+  struct rowSlab slab;
+  int64_t match_row;
+  size_t match_off, match_len;
+};
+
+void bufferStore(struct editorBuffer *b) {
+  b->filename = E.filename;
+  b->cx = E.cx;
+  b->rx = E.rx;
+  b->coloff = E.coloff;
+  b->wrapoff = E.wrapoff;
+  b->cy = E.cy;
+  b->rowoff = E.rowoff;
+  b->numrows = E.numrows;
+  b->row = E.row;
+  b->dirty = E.dirty;
+  b->syntax = E.syntax;
+  b->pager = E.pager;
+  b->hex = E.hex;
+  b->disk = E.disk;
+  b->follow = E.follow;
+  b->stream = E.stream;
+  b->slab = E.slab;
+  b->match_row = E.match_row;
+  b->match_off = E.match_off;
+  b->match_len = E.match_len;
+}
+
+void bufferRestore(struct editorBuffer *b) {
+  E.filename = b->filename;
+  E.cx = b->cx;
+  E.rx = b->rx;
+  E.coloff = b->coloff;
+  E.wrapoff = b->wrapoff;
+  E.cy = b->cy;
+  E.rowoff = b->rowoff;
+  E.numrows = b->numrows;
+  E.row = b->row;
+  E.dirty = b->dirty;
+  E.syntax = b->syntax;
+  E.pager = b->pager;
+  E.hex = b->hex;
+  E.disk = b->disk;
+  E.follow = b->follow;
+  E.stream = b->stream;
+  E.slab = b->slab;
+  E.match_row = b->match_row;
+  E.match_off = b->match_off;
+  E.match_len = b->match_len;
+}
+
+// bufferCache() counts the bytes a buffer would give back by evicting.
+size_t bufferCache(struct editorBuffer *b) {
+  if (b->pager)
+    return PAGER_CHUNKS * PAGER_CHUNK_SIZE;
+  size_t n = 0;
+  for (int64_t j = 0; j < b->numrows; j++) {
+    erow *row = &b->row[j];
+    if (!row->render_shared)
+      n += row->rsize + 1;
+    n += row->nhl * sizeof(hlspan) + editorColsSize(row->cols);
+    if (row->lr)
+      n += row->lr->chkcap * sizeof(struct hlCheckpoint);
+  }
+  return n;
+}
+
+// bufferEvict() drops the render and highlighting of a background buffer.
+// the rows' chars are copied into a new slab so the old one, with the
+// render and hl that were mixed in with them, can be freed as a whole. a
+// paged buffer is just closed, it reopens quickly.
+void bufferEvict(struct editorBuffer *b) {
+  if (b->pager) {
+    // the pager's rows give their memory back to E.slab.
+    struct rowSlab current = E.slab;
+    E.slab = b->slab;
+    pagerClose(b->pager);
+    slabFreeAll(&E.slab);
+    b->slab = E.slab;
+    E.slab = current;
+    b->pager = NULL;
+    b->numrows = 0;
+    b->loaded = 0;
+    b->cache = 0;
+    return;
+  }
+
+  struct rowSlab current = E.slab;
+  memset(&E.slab, 0, sizeof(E.slab));
+  for (int64_t j = 0; j < b->numrows; j++) {
+    erow *row = &b->row[j];
+    if (row->size + 1 <= SLAB_MAX_SIZE) {
+      char *chars = rowAlloc(row->size + 1);
+      memcpy(chars, row->chars, row->size + 1);
+      row->chars = chars;
+    }
+    if (!row->render_shared && row->rsize + 1 > SLAB_MAX_SIZE)
+      free(row->render);
+    if (row->nhl * sizeof(hlspan) > SLAB_MAX_SIZE)
+      free(row->hl);
+    if (editorColsSize(row->cols) > SLAB_MAX_SIZE)
+      free(row->cols);
+    longRowFree(row);
+    row->render = NULL;
+    row->rsize = 0;
+    row->render_shared = 0;
+    row->hl = NULL;
+    row->nhl = 0;
+    row->cols = NULL;
+  }
+  slabFreeAll(&b->slab);
+  b->slab = E.slab;
+  E.slab = current;
+  b->stale = 1;
+  b->cache = 0;
+}
+
+void bufferEvictOld() {
+  while (1) {
+    size_t total = 0;
+    struct editorBuffer *lru = NULL;
+    for (int i = 0; i < E.nbuf; i++) {
+      struct editorBuffer *b = &E.buf[i];
+      if (i == E.curbuf || b->cache == 0)
+        continue;
+      total += b->cache;
+      if (lru == NULL || b->used < lru->used)
+        lru = b;
+    }
+    if (total <= E.cache_cap || lru == NULL)
+      return;
+    bufferEvict(lru);
+  }
+}
+
+void editorSwitchBuffer(int n) {
+  if (n == E.curbuf || n < 0 || n >= E.nbuf)
+    return;
+  struct editorBuffer *b = &E.buf[E.curbuf];
+  bufferStore(b);
+  b->cache = bufferCache(b);
+
+  E.curbuf = n;
+  b = &E.buf[n];
+  bufferRestore(b);
+  b->used = ++E.buftick;
+  if (!b->loaded) {
+    char *filename = E.filename;
+    E.filename = NULL;
+    editorOpen(filename);
+    free(filename);
+    b->loaded = 1;
+    // a paged buffer that was evicted comes back where it was.
+    if (E.cy > E.numrows)
+      E.cy = E.numrows;
+  } else if (b->stale) {
+    for (int64_t j = 0; j < E.numrows; j++)
+      editorUpdateRow(&E.row[j]);
+    b->stale = 0;
+  }
+  bufferEvictOld();
+  editorUndoFree();
+  editorWatch();
+  editorCheckDisk();
+}
+
+// editorAnyDirty() tells whether any buffer has unsaved changes.
+int editorAnyDirty() {
+  if (E.dirty)
+    return 1;
+  for (int i = 0; i < E.nbuf; i++) {
+    if (i != E.curbuf && E.buf[i].dirty)
+      return 1;
+  }
+  return 0;
+}
+
+/*** external changes */
+
+// the directory of the current file is watched with inotify, so that
+// writes and renames over the file are both seen. when the file changed,
+// the rows that are the same at the start and at the end are kept and only
+// the lines in between are replaced, so after a small edit elsewhere the
+// cost is reading and comparing the file, not laying out and highlighting
+// all of it again.
+
+int editorFileIdOf(const char *path, struct editorFileId *id) {
+  struct stat st;
+  memset(id, 0, sizeof(*id));
+  if (path == NULL || stat(path, &st) == -1)
+    return -1;
+  id->dev = st.st_dev;
+  id->ino = st.st_ino;
+  id->size = st.st_size;
+  id->mtime = st.st_mtim;
+  return 0;
+}
+
+int editorFileIdEqual(struct editorFileId *a, struct editorFileId *b) {
+  return a->dev == b->dev && a->ino == b->ino && a->size == b->size &&
+         a->mtime.tv_sec == b->mtime.tv_sec &&
+         a->mtime.tv_nsec == b->mtime.tv_nsec;
+}
+
+void editorWatch() {
+  if (E.inotify_fd <= 0) {
+    E.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    E.inotify_wd = -1;
+    if (E.inotify_fd == -1)
+      return;
+  }
+  if (E.inotify_wd != -1)
+    inotify_rm_watch(E.inotify_fd, E.inotify_wd);
+  E.inotify_wd = -1;
+  if (E.filename == NULL)
+    return;
+
+  char *slash = strrchr(E.filename, '/');
+  char *dir = slash ? strndup(E.filename, slash - E.filename + 1) : strdup(".");
+  E.inotify_wd = inotify_add_watch(E.inotify_fd, dir,
+                                   IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO |
+                                       IN_CREATE | IN_ATTRIB);
+  free(dir);
+}
+
+// editorReadLine() finds the line that starts at p in a file mapped at
+// [p, end), the same way editorOpen() reads lines. it returns the length
+// without the line ending and sets *next to where the next line starts.
+size_t editorReadLine(const char *p, const char *end, const char **next) {
+  const char *nl = memchr(p, '\n', end - p);
+  const char *e = nl ? nl : end;
+  *next = nl ? nl + 1 : end;
+  while (e > p && (e[-1] == '\r' || e[-1] == '\n'))
+    e--;
+  return e - p;
+}
+
+int editorRowIs(int64_t at, const char *s, size_t len) {
+  erow *row = &E.row[at];
+  return row->size == len && memcmp(row->chars, s, len) == 0;
+}
+
+// editorReload() brings the rows in line with the file on disk.
+void editorReload() {
+  struct stat st;
+  int fd = open(E.filename, O_RDONLY);
+  if (fd == -1 || fstat(fd, &st) == -1) {
+    if (fd != -1)
+      close(fd);
+    editorSetStatusMessage("Can't reload! I/O error: %s", strerror(errno));
+    return;
+  }
+  if (E.pager || E.hex || E.stream.comp ||
+      st.st_size >= TEXT_EDITOR_PAGE_THRESHOLD) {
+    // paged files only keep an index, which has to be built again anyway,
+    // compressed ones are decompressed again from the start, and hex views
+    // just map the file again.
+    close(fd);
+    size_t cx = E.cx;
+    int64_t cy = E.cy, rowoff = E.rowoff;
+    off_t cur = E.hex ? E.hex->cur : 0, top = E.hex ? E.hex->top : 0;
+    char *filename = strdup(E.filename);
+    editorOpenView(filename, E.hex != NULL);
+    free(filename);
+    E.cy = cy < E.numrows ? cy : E.numrows;
+    E.cx = E.cy < E.numrows && cx <= editorRow(E.cy)->size ? cx : 0;
+    E.rowoff = rowoff;
+    if (E.hex) {
+      E.hex->cur = cur;
+      E.hex->top = top;
+    }
+    return;
+  }
+
+  const char *map = NULL;
+  if (st.st_size > 0) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      close(fd);
+      editorSetStatusMessage("Can't reload! I/O error: %s", strerror(errno));
+      return;
+    }
+  }
+  close(fd);
+  const char *end = map + st.st_size;
+
+  // rows at the start that did not change.
+  const char *p = map, *next;
+  int64_t pre = 0;
+  while (pre < E.numrows && p < end) {
+    size_t len = editorReadLine(p, end, &next);
+    if (!editorRowIs(pre, p, len))
+      break;
+    pre++;
+    p = next;
+  }
+
+  // rows at the end that did not change, walking the file backwards. tail
+  // is where the lines after the changed ones start, lines end at the
+  // newline before the previous tail or at the end of the file.
+  const char *tail = end;
+  int64_t suf = 0;
+  while (suf < E.numrows - pre && tail > p) {
+    const char *nl = tail == end && end[-1] != '\n' ? end : tail - 1;
+    const char *start = nl;
+    while (start > p && start[-1] != '\n')
+      start--;
+    size_t len = editorReadLine(start, nl, &next);
+    if (!editorRowIs(E.numrows - 1 - suf, start, len))
+      break;
+    suf++;
+    tail = start;
+  }
+
+  int64_t ins = 0;
+  for (const char *q = p; q < tail; q = next) {
+    editorReadLine(q, tail, &next);
+    ins++;
+  }
+  int64_t del = E.numrows - pre - suf;
+  editorSpliceRows(pre, del, ins);
+  int64_t at = pre;
+  for (const char *q = p; q < tail; q = next, at++) {
+    size_t len = editorReadLine(q, tail, &next);
+    editorInitRow(&E.row[at], at, q, len);
+  }
+  for (at = pre; at < pre + ins; at++)
+    editorUpdateRow(&E.row[at]);
+  if (ins == 0 && pre < E.numrows)
+    editorUpdateSyntax(&E.row[pre]);
+  // the first kept row after the change may start in a different comment
+  // state now.
+  const char *nl = map ? memchr(map, '\n', st.st_size) : NULL;
+  int crlf = nl && nl > map && nl[-1] == '\r';
+  if (map)
+    munmap((void *)map, st.st_size);
+
+  E.dirty = 0;
+  E.match_row = -1;
+  editorFileIdOf(E.filename, &E.disk);
+  E.disk.size = st.st_size;
+  E.disk.crlf = crlf;
+  editorFollowSync();
+  if (E.cy > E.numrows)
+    E.cy = E.numrows;
+  if (E.cy < E.numrows && E.cx > E.row[E.cy].size)
+    E.cx = E.row[E.cy].size;
+  editorSetStatusMessage("Reloaded: %" PRId64 " lines changed", ins > del ? ins : del);
+}
+
+// editorCheckDisk() reloads the current file if it changed on disk, asking
+// first when there are unsaved changes.
+void editorCheckDisk() {
+  struct editorFileId id;
+  if (E.filename == NULL || E.checking_disk ||
+      editorFileIdOf(E.filename, &id) == -1 || editorFileIdEqual(&id, &E.disk))
+    return;
+
+  if (E.follow.on && id.dev == E.disk.dev && id.ino == E.disk.ino &&
+      id.size >= E.follow.off) {
+    editorFollowRead(&id);
+    return;
+  }
+  // a file that got shorter or was replaced, which is what log rotation
+  // does, is read again from the start.
+
+  E.checking_disk = 1;
+  int reload = 1;
+  if (E.dirty) {
+    char *answer = editorPrompt(
+        "File changed on disk, reload and lose your changes? (y/n) %s", NULL);
+    reload = answer && (answer[0] == 'y' || answer[0] == 'Y');
+    free(answer);
+  }
+  if (reload) {
+    editorReload();
+    if (E.follow.on)
+      editorFollowTrim(E.follow_max);
+  } else {
+    editorSetStatusMessage("Kept your changes, saving will overwrite the file");
+    E.disk = id;
+  }
+  E.checking_disk = 0;
+}
+
+// editorIdle() runs while waiting for a key.
+void editorIdle() {
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  editorServerIdle();
+  if (E.pager)
+    pagerScanComments(E.pager, PAGER_SCAN_BUDGET);
+  if (diffWork(DIFF_IDLE_BUDGET))
+    editorRefreshScreen();
+  symbolWork(SYMBOL_IDLE_BUDGET);
+  wordsWork(WORD_IDLE_BUDGET);
+  int seen = E.follow.on;
+  // a followed file is checked every time, a log written faster than it is
+  // read keeps growing without any new events.
+  ssize_t n;
+  while (!E.prompting && E.inotify_fd > 0 &&
+         (n = read(E.inotify_fd, buf, sizeof(buf))) > 0)
+    seen = 1;
+  // while a prompt is open the events wait in the queue, a reload would
+  // pull the rows out from under a search or a jump in progress.
+  int64_t numrows = E.numrows;
+  if (!E.prompting)
+    editorFollowTrim(E.follow_max);
+  if (editorStreamRead() || numrows != E.numrows)
+    editorRefreshScreen();
+  else if (seen && !E.checking_disk && !E.prompting) {
+    int dirty = E.dirty;
+    struct editorFileId before = E.disk;
+    editorCheckDisk();
+    if (!editorFileIdEqual(&before, &E.disk) || numrows != E.numrows ||
+        dirty != E.dirty)
+      editorRefreshScreen();
+  }
+}
+
+/*** diff against disk */
+
+// Ctrl-D shows a gutter with what changed since the file was read or saved:
+// a green + for added rows, a yellow ~ for changed ones and a red - on the
+// row below lines that were deleted (_ on the last row for lines deleted at
+// the end). the file and the rows are reduced to one hash per line and
+// compared with Myers' diff in linear space: each range is split at its
+// middle snake and the halves are pushed on a stack of jobs. the work runs
+// in slices, a little before every frame and more while idle, and starts
+// over whenever the rows or the file change, so typing never waits for it.
+// until it catches up the previous marks stay on screen.
+
+struct diffJob {
+  int64_t a0, a1, b0, b1;
+};
+
+void diffFree() {
+  struct editorDiff *d = &E.diff;
+  free(d->a);
+  free(d->b);
+  free(d->jobs);
+  free(d->v);
+  free(d->mark);
+  free(d->work);
+  int on = d->on;
+  memset(d, 0, sizeof(*d));
+  d->on = on;
+}
+
+void diffPush(struct editorDiff *d, int64_t a0, int64_t a1, int64_t b0,
+              int64_t b1) {
+  if (d->njobs == d->jobcap) {
+    d->jobcap = d->jobcap ? d->jobcap * 2 : 64;
+    d->jobs = realloc(d->jobs, d->jobcap * sizeof(struct diffJob));
+    if (d->jobs == NULL)
+      die("realloc");
+  }
+  struct diffJob *j = &d->jobs[d->njobs++];
+  j->a0 = a0;
+  j->a1 = a1;
+  j->b0 = b0;
+  j->b1 = b1;
+}
+
+// diffHash() hashes a line eight bytes at a time, every row is hashed again
+// after each edit.
+uint64_t diffHash(const char *s, size_t n) {
+  uint64_t h = n * 0x9e3779b97f4a7c15ULL, w;
+  for (; n >= 8; s += 8, n -= 8) {
+    memcpy(&w, s, 8);
+    h = (h ^ w) * 0xff51afd7ed558ccdULL;
+    h ^= h >> 32;
+  }
+  w = 0;
+  memcpy(&w, s, n);
+  h = (h ^ w) * 0xc4ceb9fe1a85ec53ULL;
+  return h ^ h >> 29;
+}
+
+void diffAppend(uint64_t **v, int64_t *n, int64_t *cap, uint64_t h) {
+  if (*n == *cap) {
+    *cap = *cap ? *cap * 2 : 1024;
+    *v = realloc(*v, *cap * sizeof(uint64_t));
+    if (*v == NULL)
+      die("realloc");
+  }
+  (*v)[(*n)++] = h;
+}
+
+// diffHashDisk() hashes the lines of the file from where it left off until
+// deadline. it returns 1 once the whole file is done.
+int diffHashDisk(struct editorDiff *d, int64_t deadline) {
+  struct stat st;
+  int fd = E.filename ? open(E.filename, O_RDONLY) : -1;
+  if (fd == -1 || fstat(fd, &st) == -1 || st.st_size == 0) {
+    // a new file has no lines yet, so every row is added.
+    if (fd != -1)
+      close(fd);
+    return 1;
+  }
+  char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return 1;
+
+  char *p = map + d->pos, *end = map + st.st_size;
+  int64_t n = 0;
+  while (p < end) {
+    // lines are split the way editorOpen() splits them.
+    char *nl = memchr(p, '\n', end - p);
+    char *e = nl ? nl : end;
+    while (e > p && (e[-1] == '\r' || e[-1] == '\n'))
+      e--;
+    diffAppend(&d->a, &d->na, &d->acap, diffHash(p, e - p));
+    p = nl ? nl + 1 : end;
+    if (++n % 1024 == 0 && editorNow() > deadline)
+      break;
+  }
+  d->pos = p - map;
+  munmap(map, st.st_size);
+  return p == end;
+}
+
+// diffDeleted() notes that lines of the file are missing before row at.
+void diffDeleted(struct editorDiff *d, int64_t at) {
+  if (at < d->nb)
+    d->work[at] |= DIFF_DELETED;
+  else if (d->nb > 0)
+    d->work[d->nb - 1] |= DIFF_DELETED_END;
+}
+
+// diffSplit() finds the middle snake of a[a0..a1) and b[b0..b1), whose
+// first and last lines differ, and returns where it starts in *x and *y.
+// when the two have nothing in common *x is -1. past DIFF_MAX_WORK steps it
+// settles for the forward path that got furthest, like GNU diff does, so one
+// split never takes long; the diff is then still right but maybe not the
+// shortest.
+void diffSplit(struct editorDiff *d, int64_t a0, int64_t a1, int64_t b0,
+               int64_t b1, int64_t *sx, int64_t *sy) {
+  const uint64_t *a = d->a + a0, *b = d->b + b0;
+  int64_t n = a1 - a0, m = b1 - b0;
+  int64_t maxd = (n + m + 1) / 2;
+  int64_t off = maxd, len = 2 * maxd + 2;
+  if ((size_t)(2 * len) > d->vcap) {
+    d->vcap = 2 * len;
+    free(d->v);
+    d->v = malloc(d->vcap * sizeof(int64_t));
+    if (d->v == NULL)
+      die("malloc");
+  }
+  int64_t *v1 = d->v, *v2 = d->v + len;
+  int64_t w = 1;
+  // only v[off - w .. off + w] is set, -1 where no path got yet. it grows
+  // with the edit distance, so a split costs nothing like n + m up front.
+  for (int64_t i = off - 1; i <= off + 1; i++)
+    v1[i] = v2[i] = -1;
+  v1[off + 1] = 0;
+  v2[off + 1] = 0;
+  int64_t delta = n - m;
+  int front = delta % 2 != 0;
+  // v1 holds how far each diagonal got from the start, v2 from the end.
+  // with an odd delta the forward paths are the ones that can meet the
+  // backward ones, with an even delta it is the other way around.
+  int64_t k1start = 0, k1end = 0, k2start = 0, k2end = 0, work = 0;
+
+  for (int64_t e = 0; e < maxd; e++) {
+    while (w < e + 1) {
+      w++;
+      v1[off - w] = v1[off + w] = v2[off - w] = v2[off + w] = -1;
+    }
+    for (int64_t k = -e + k1start; k <= e - k1end; k += 2) {
+      int64_t i = off + k;
+      int64_t x = k == -e || (k != e && v1[i - 1] < v1[i + 1]) ? v1[i + 1]
+                                                              : v1[i - 1] + 1;
+      int64_t y = x - k;
+      while (x < n && y < m && a[x] == b[y]) {
+        x++;
+        y++;
+        work++;
+      }
+      v1[i] = x;
+      if (x > n) {
+        k1end += 2;
+      } else if (y > m) {
+        k1start += 2;
+      } else if (front) {
+        int64_t j = off + delta - k;
+        if (j >= off - w && j <= off + w && v2[j] != -1 && x >= n - v2[j]) {
+          *sx = a0 + x;
+          *sy = b0 + y;
+          return;
+        }
+      }
+    }
+    for (int64_t k = -e + k2start; k <= e - k2end; k += 2) {
+      int64_t i = off + k;
+      int64_t x = k == -e || (k != e && v2[i - 1] < v2[i + 1]) ? v2[i + 1]
+                                                              : v2[i - 1] + 1;
+      int64_t y = x - k;
+      while (x < n && y < m && a[n - x - 1] == b[m - y - 1]) {
+        x++;
+        y++;
+        work++;
+      }
+      v2[i] = x;
+      if (x > n) {
+        k2end += 2;
+      } else if (y > m) {
+        k2start += 2;
+      } else if (!front) {
+        int64_t j = off + delta - k;
+        if (j >= off - w && j <= off + w && v1[j] != -1 && v1[j] >= n - x) {
+          *sx = a0 + v1[j];
+          *sy = b0 + v1[j] - (j - off);
+          return;
+        }
+      }
+    }
+
+    work += 2 * (e + 1);
+    if (work > DIFF_MAX_WORK) {
+      int64_t best = 0;
+      for (int64_t k = -e + k1start; k <= e - k1end; k += 2) {
+        int64_t x = v1[off + k], y = x - k;
+        if (x <= n && y >= 0 && y <= m && x + y > best &&
+            x + y < n + m) {
+          best = x + y;
+          *sx = a0 + x;
+          *sy = b0 + y;
+        }
+      }
+      if (best > 0)
+        return;
+      break;
+    }
+  }
+  *sx = -1;
+  *sy = -1;
+}
+
+// diffRun() does one job: it strips the lines both ranges start and end
+// with, and either marks what is left or splits it into two more jobs.
+void diffRun(struct editorDiff *d, struct diffJob j) {
+  while (j.a0 < j.a1 && j.b0 < j.b1 && d->a[j.a0] == d->b[j.b0]) {
+    j.a0++;
+    j.b0++;
+  }
+  while (j.a0 < j.a1 && j.b0 < j.b1 && d->a[j.a1 - 1] == d->b[j.b1 - 1]) {
+    j.a1--;
+    j.b1--;
+  }
+  if (j.a0 == j.a1 || j.b0 == j.b1) {
+    if (j.a0 < j.a1)
+      diffDeleted(d, j.b0);
+    for (int64_t r = j.b0; r < j.b1; r++)
+      d->work[r] |= DIFF_ADDED;
+    return;
+  }
+  int64_t x, y;
+  diffSplit(d, j.a0, j.a1, j.b0, j.b1, &x, &y);
+  if (x == -1) {
+    diffDeleted(d, j.b0);
+    for (int64_t r = j.b0; r < j.b1; r++)
+      d->work[r] |= DIFF_ADDED;
+    return;
+  }
+  diffPush(d, j.a0, x, j.b0, y);
+  diffPush(d, x, j.a1, y, j.b1);
+}
+
+// diffFinish() turns rows added where lines were deleted into changed rows,
+// counts the marks and shows them.
+void diffFinish(struct editorDiff *d) {
+  unsigned char *w = d->work;
+  for (int64_t r = 0; r < d->nb; r++) {
+    if ((w[r] & DIFF_ADDED) && (w[r] & DIFF_DELETED)) {
+      // the added rows from here on took the place of the deleted lines.
+      w[r] = (w[r] & DIFF_DELETED_END) | DIFF_CHANGED;
+      while (r + 1 < d->nb && (w[r + 1] & ~DIFF_DELETED_END) == DIFF_ADDED) {
+        r++;
+        w[r] = (w[r] & DIFF_DELETED_END) | DIFF_CHANGED;
+      }
+    }
+  }
+  d->added = d->changed = d->deleted = 0;
+  for (int64_t r = 0; r < d->nb; r++) {
+    d->added += (w[r] & DIFF_ADDED) != 0;
+    d->changed += (w[r] & DIFF_CHANGED) != 0;
+    d->deleted += (w[r] & DIFF_DELETED) != 0;
+    d->deleted += (w[r] & DIFF_DELETED_END) != 0;
+  }
+  d->work = d->mark;
+  d->mark = w;
+  d->nmark = d->nb;
+  int64_t cap = d->workcap;
+  d->workcap = d->markcap;
+  d->markcap = cap;
+}
+
+// diffWork() gets on with the diff for about budget nanoseconds. it returns
+// 1 when that made new marks.
+int diffWork(int64_t budget) {
+  struct editorDiff *d = &E.diff;
+  if (!d->on)
+    return 0;
+  if (E.pager || E.hex || E.stream.comp || E.stream.fd != -1) {
+    // paged files are read-only, the others can't be compared by line.
+    d->nmark = 0;
+    d->busy = 0;
+    return 0;
+  }
+  int other = d->buf != E.curbuf || !editorFileIdEqual(&d->disk, &E.disk);
+  if (other || d->dirty != E.dirty || d->numrows != E.numrows) {
+    if (other) {
+      d->na = 0;
+      d->pos = 0;
+      d->disk_done = 0;
+    }
+    if (d->buf != E.curbuf)
+      d->nmark = 0;
+    d->buf = E.curbuf;
+    d->disk = E.disk;
+    d->dirty = E.dirty;
+    d->numrows = E.numrows;
+    d->nb = 0;
+    d->njobs = 0;
+    d->started = 0;
+    d->busy = 1;
+  }
+  if (!d->busy)
+    return 0;
+
+  int64_t deadline = editorNow() + budget;
+  if (!d->disk_done) {
+    if (!diffHashDisk(d, deadline))
+      return 0;
+    d->disk_done = 1;
+  }
+  while (d->nb < E.numrows) {
+    erow *row = &E.row[d->nb];
+    diffAppend(&d->b, &d->nb, &d->bcap, diffHash(row->chars, row->size));
+    if (d->nb % 1024 == 0 && editorNow() > deadline)
+      return 0;
+  }
+  if (!d->started) {
+    if (d->workcap < d->nb + 1) {
+      d->workcap = d->nb + 1;
+      free(d->work);
+      d->work = malloc(d->workcap);
+      if (d->work == NULL)
+        die("malloc");
+    }
+    memset(d->work, 0, d->nb + 1);
+    diffPush(d, 0, d->na, 0, d->nb);
+    d->started = 1;
+  }
+  while (d->njobs > 0) {
+    if (editorNow() > deadline)
+      return 0;
+    diffRun(d, d->jobs[--d->njobs]);
+  }
+  diffFinish(d);
+  d->busy = 0;
+  return 1;
+}
+
+// editorToggleDiff() shows or hides the diff gutter, which takes
+// DIFF_GUTTER columns from the text.
+void editorToggleDiff() {
+  struct editorDiff *d = &E.diff;
+  if (d->on) {
+    d->on = 0;
+    diffFree();
+    E.screencols += DIFF_GUTTER;
+    editorSetStatusMessage("Diff gutter off");
+    return;
+  }
+  if (E.pager || E.hex || E.stream.comp) {
+    editorSetStatusMessage("No diff for paged, hex or compressed files");
+    return;
+  }
+  if (E.screencols <= DIFF_GUTTER)
+    return;
+  d->on = 1;
+  d->buf = -1;
+  // nothing was compared yet, so the first diffWork() starts over.
+  E.screencols -= DIFF_GUTTER;
+  editorSetStatusMessage("Changes since the file was saved: + added, "
+                         "~ changed, - deleted. Ctrl-D hides them");
+}
+
+/*** follow mode */
+
+// follow mode is tail -f: bytes appended to the file are read from where
+// loading stopped, in large blocks, and each block is added as rows in one
+// go. the screen is only drawn again once per batch, when editorIdle() sees
+// the row count change, and it only scrolls along while the cursor is on the
+// last row. with --max-lines the oldest rows are dropped as new ones come in,
+// after which the buffer no longer matches the file and is read-only.
+
+// editorFollowSync() makes follow mode continue from the end of the file as
+// it was last read.
+void editorFollowSync() {
+  E.follow.off = E.disk.size;
+  E.follow.partial = 0;
+  E.follow.dropped = 0;
+  int fd = open(E.filename, O_RDONLY);
+  char c;
+  if (fd == -1)
+    return;
+  if (E.disk.size > 0 && pread(fd, &c, 1, E.disk.size - 1) == 1 && c != '\n')
+    E.follow.partial = 1;
+  close(fd);
+}
+
+// editorFollowAppend() adds the lines in s to the end of the document,
+// continuing the last row when it had no newline yet.
+void editorFollowAppend(const char *s, size_t len) {
+  const char *end = s + len, *next;
+  if (E.follow.partial && E.numrows > 0) {
+    const char *nl = memchr(s, '\n', len);
+    erow *row = &E.row[E.numrows - 1];
+    editorRowAppendString(row, (char *)s, (nl ? nl : end) - s);
+    if (nl == NULL)
+      return;
+    while (row->size > 0 && row->chars[row->size - 1] == '\r')
+      editorRowDelChar(row, row->size - 1);
+    E.follow.partial = 0;
+    s = nl + 1;
+  }
+  if (s == end)
+    return;
+
+  int64_t ins = 0;
+  for (const char *q = s; q < end; q = next) {
+    editorReadLine(q, end, &next);
+    ins++;
+  }
+  int64_t at = E.numrows;
+  editorSpliceRows(at, 0, ins);
+  for (const char *q = s; q < end; q = next, at++) {
+    size_t n = editorReadLine(q, end, &next);
+    editorInitRow(&E.row[at], at, q, n);
+  }
+  for (at = E.numrows - ins; at < E.numrows; at++)
+    editorUpdateRow(&E.row[at]);
+  E.follow.partial = end[-1] != '\n';
+}
+
+// editorFollowTrim() drops rows from the top until at most keep are left.
+void editorFollowTrim(int64_t keep) {
+  if (E.pager || E.prompting || E.follow_max <= 0 || E.numrows <= keep)
+    return;
+  // an open prompt may hold on to row numbers, editorIdle() trims once it
+  // is closed.
+  int64_t k = E.numrows - keep;
+  editorSpliceRows(0, k, 0);
+  E.follow.dropped += k;
+  E.cy = E.cy > k ? E.cy - k : 0;
+  E.rowoff = E.rowoff > k ? E.rowoff - k : 0;
+  E.wrapoff = 0;
+  E.match_row = -1;
+}
+
+// editorFollowRead() reads what was appended to the file since the last
+// read, id is the file as it is now.
+void editorFollowRead(struct editorFileId *id) {
+  int bottom = E.cy >= E.numrows - 1;
+  int dirty = E.dirty;
+  int64_t t = TRACE_BEGIN();
+
+  if (E.pager) {
+    if (pagerGrow(E.pager) == -1) {
+      editorSetStatusMessage("Can't follow! I/O error: %s", strerror(errno));
+      return;
+    }
+    E.numrows = E.pager->numlines;
+    E.follow.off = E.pager->filesize;
+  } else {
+    int fd = open(E.filename, O_RDONLY);
+    size_t bufsize = 1024 * 1024;
+    char *buf = malloc(bufsize);
+    if (fd == -1 || buf == NULL) {
+      if (fd != -1)
+        close(fd);
+      free(buf);
+      editorSetStatusMessage("Can't follow! I/O error: %s", strerror(errno));
+      return;
+    }
+    off_t limit = E.follow.off + FOLLOW_READ_MAX;
+    while (E.follow.off < id->size && E.follow.off < limit) {
+      ssize_t n = pread(fd, buf, bufsize, E.follow.off);
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      editorFollowAppend(buf, n);
+      E.follow.off += n;
+      if (E.follow_max > 0 && E.numrows > 2 * E.follow_max)
+        editorFollowTrim(E.follow_max);
+      // trimming moves every row, so let a few batches pile up first.
+    }
+    free(buf);
+    close(fd);
+    editorFollowTrim(E.follow_max);
+  }
+  E.dirty = dirty;
+  int crlf = E.disk.crlf;
+  E.disk = *id;
+  E.disk.size = E.follow.off;
+  E.disk.crlf = crlf;
+  // when more was appended than FOLLOW_READ_MAX, the sizes differ and the
+  // rest is read on the next check.
+
+  if (bottom && E.numrows > 0) {
+    E.cy = E.numrows - 1;
+    E.cx = 0;
+  }
+  TRACE_END("follow", t);
+}
+
+void editorToggleFollow() {
+  if (E.follow.on) {
+    E.follow.on = 0;
+    editorSetStatusMessage("Follow mode off");
+    return;
+  }
+  if ((E.filename == NULL && E.curbuf != E.stream_buf) || E.dirty ||
+      E.stream.comp) {
+    editorSetStatusMessage(E.dirty         ? "Save your changes before following"
+                           : E.stream.comp ? "Can't follow a compressed file"
+                                           : "Nothing to follow, open a file "
+                                             "first");
+    return;
+  }
+  E.follow.on = 1;
+  E.cy = E.numrows > 0 ? E.numrows - 1 : 0;
+  E.cx = 0;
+  editorCheckDisk();
+  editorSetStatusMessage("Following %.40s, Ctrl-E to stop",
+                         E.filename ? E.filename : "stdin");
+}
+
+/*** reading from stdin */
+
+// `./main -`, or no file with stdin not a terminal, reads the document from
+// stdin. the pipe is moved to another fd and /dev/tty takes its place, so
+// the terminal code keeps using STDIN_FILENO. the pipe is non-blocking and
+// read while waiting for keys, with the follow mode code adding the rows,
+// so the first screen shows as soon as there is data and keys are never
+// held up by a slow producer.
+
+// editorStreamTty() puts the terminal on stdin and returns the old stdin.
+// it runs before enableRawMode().
+int editorStreamTty() {
+  int fd = dup(STDIN_FILENO);
+  if (fd == -1)
+    die("dup");
+  int tty = open("/dev/tty", O_RDWR);
+  if (tty == -1 || dup2(tty, STDIN_FILENO) == -1)
+    die("/dev/tty");
+  close(tty);
+  return fd;
+}
+
+// editorStreamOpen() starts reading fd into the buffer that st belongs to.
+void editorStreamOpen(struct editorStream *st, int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  struct stat sb;
+  st->size = 0;
+  if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode))
+    st->size = sb.st_size;
+  st->fd = fd;
+  st->bytes = 0;
+}
+
+// editorStreamClose() stops reading, stopping the decompressor too when
+// abort is set. it tells whether the decompressor, if any, did its job.
+int editorStreamClose(int abort) {
+  int ok = 1;
+  if (E.stream.fd != -1)
+    close(E.stream.fd);
+  E.stream.fd = -1;
+  if (E.stream.pid > 0) {
+    int status;
+    if (abort)
+      kill(E.stream.pid, SIGTERM);
+    ok = waitpid(E.stream.pid, &status, 0) != -1 && WIFEXITED(status) &&
+         WEXITSTATUS(status) == 0;
+  }
+  E.stream.pid = 0;
+  return ok;
+}
+
+// editorStreamWait() waits up to a tenth of a second for a key or for data
+// on the stream, and tells whether a key can be read now.
+int editorStreamWait() {
+  if (E.stream.fd == -1)
+    return 1;
+  struct pollfd fds[2] = {{.fd = STDIN_FILENO, .events = POLLIN},
+                          {.fd = E.stream.fd, .events = POLLIN}};
+  if (poll(fds, 2, 100) == -1)
+    return errno != EINTR;
+  return fds[0].revents != 0;
+}
+
+// editorStreamRead() reads what the stream has for up to 50 ms and adds it
+// as rows. it returns 1 when the screen needs to be drawn again.
+int editorStreamRead() {
+  if (E.stream.fd == -1)
+    return 0;
+  int bottom = E.follow.on && E.cy >= E.numrows - 1;
+  int dirty = E.dirty;
+  int64_t numrows = E.numrows;
+  off_t bytes = E.stream.bytes;
+  int64_t t = TRACE_BEGIN();
+
+  size_t bufsize = 1024 * 1024;
+  char *buf = malloc(bufsize);
+  if (buf == NULL)
+    die("malloc");
+  int64_t start = editorNow();
+  while (editorNow() - start < 50 * 1000000L) {
+    ssize_t n = read(E.stream.fd, buf, bufsize);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1 && errno == EAGAIN)
+      break;
+    if (n <= 0) {
+      int err = n == -1 ? errno : 0;
+      if (!editorStreamClose(0))
+        editorSetStatusMessage("Can't decompress! %s failed",
+                               E.stream.comp->name);
+      else if (err)
+        editorSetStatusMessage("Can't read %s! I/O error: %s",
+                               E.filename ? E.filename : "stdin",
+                               strerror(err));
+      else
+        editorSetStatusMessage("Read %" PRId64 " lines (%.1f MB) from %.20s",
+                               E.numrows, E.stream.bytes / 1e6,
+                               E.filename ? E.filename : "stdin");
+      break;
+    }
+    editorFollowAppend(buf, n);
+    E.stream.bytes += n;
+    if (E.follow_max > 0 && E.numrows > 2 * E.follow_max)
+      editorFollowTrim(E.follow_max);
+  }
+  free(buf);
+  editorFollowTrim(E.follow_max);
+  E.dirty = dirty;
+
+  if (bottom && E.numrows > 0) {
+    E.cy = E.numrows - 1;
+    E.cx = 0;
+  }
+  TRACE_END("stream", t);
+  return E.numrows != numrows || E.stream.bytes != bytes || E.stream.fd == -1;
+}
+
+/*** compressed files */
+
+// gzip and zstd files are recognized by their first bytes and read through
+// `gzip -dc` or `zstd -dc` in a child process, which works in the
+// background while the rows come in through the same non-blocking stream
+// as stdin. the whole text ends up in rows, so moving around never needs to
+// decompress again. saving pipes the text through the compressor, either
+// for a file that was opened compressed or for a new name ending in .gz or
+// .zst.
+
+// editorCompressorOf() returns the format of the file open on fd, or NULL.
+struct editorCompressor *editorCompressorOf(int fd) {
+  unsigned char magic[4];
+  ssize_t n = pread(fd, magic, sizeof(magic), 0);
+  for (unsigned int j = 0; j < COMPRESSORS_ENTRIES; j++) {
+    struct editorCompressor *c = &COMPRESSORS[j];
+    if (n >= c->magiclen && memcmp(magic, c->magic, c->magiclen) == 0)
+      return c;
+  }
+  return NULL;
+}
+
+// editorCompressorFor() returns the format that a file name asks for.
+struct editorCompressor *editorCompressorFor(const char *filename) {
+  char *ext = filename ? strrchr(filename, '.') : NULL;
+  for (unsigned int j = 0; ext && j < COMPRESSORS_ENTRIES; j++) {
+    if (strcmp(ext, COMPRESSORS[j].ext) == 0)
+      return &COMPRESSORS[j];
+  }
+  return NULL;
+}
+
+// editorSpawn() runs argv with stdin and stdout on in and out, and its
+// stderr thrown away so it can't mess up the screen.
+pid_t editorSpawn(char **argv, int in, int out) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    dup2(in, STDIN_FILENO);
+    dup2(out, STDOUT_FILENO);
+    if (null != -1)
+      dup2(null, STDERR_FILENO);
+    execvp(argv[0], argv);
+    _exit(127);
+  }
+  return pid;
+}
+
+// editorOpenCompressed() starts decompressing the file open on fd into the
+// current buffer.
+void editorOpenCompressed(int fd, struct editorCompressor *comp) {
+  int pipefd[2];
+  if (pipe2(pipefd, O_CLOEXEC) == -1) {
+    close(fd);
+    editorOpenFailed("pipe");
+    return;
+  }
+  pid_t pid = editorSpawn(comp->decompress, fd, pipefd[1]);
+  if (pid == -1) {
+    close(fd);
+    close(pipefd[0]);
+    close(pipefd[1]);
+    editorOpenFailed("fork");
+    return;
+  }
+  close(pipefd[1]);
+  close(fd);
+  editorStreamOpen(&E.stream, pipefd[0]);
+  E.stream.pid = pid;
+  E.stream.comp = comp;
+}
+
+// editorWriteCompressed() writes len bytes of buf to fd through comp.
+int editorWriteCompressed(struct editorCompressor *comp, int fd, char *buf,
+                          size_t len) {
+  int pipefd[2];
+  if (pipe2(pipefd, O_CLOEXEC) == -1)
+    return -1;
+  // the child must not hold on to the write end, or it never sees the end
+  // of its input.
+  pid_t pid = editorSpawn(comp->compress, pipefd[0], fd);
+  close(pipefd[0]);
+  if (pid == -1) {
+    close(pipefd[1]);
+    return -1;
+  }
+  void (*sigpipe)(int) = signal(SIGPIPE, SIG_IGN);
+  int ret = writeAll(pipefd[1], buf, len);
+  close(pipefd[1]);
+  signal(SIGPIPE, sigpipe);
+  int status;
+  if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0)
+    ret = -1;
+  return ret;
+}
+
+// find
+
+void editorFindCallBack(char *query, int key) {
+  static int64_t last_match = -1;
+  // static is used to make a variable persist between function calls.
+  static int direction = 1;
+
+  E.match_row = -1;
+  // clear the HL_MATCH overlay of the previous match.
+  if (key == '\r' || key == '\x1b') {
+    last_match = -1;
+    direction = 1;
+
+    return;
+  } else if (key == Arrow_Right || key == Arrow_Down) {
+    direction = 1;
+  } else if (key == Arrow_Left || key == Arrow_Up) {
+    direction = -1;
+  } else {
+    last_match = -1;
+    direction = 1;
+  }
+
+  if (last_match >= E.numrows)
+    last_match = -1;
+  if (last_match == -1)
+    direction = 1;
+
+  int64_t current = last_match;
+
+  for (int64_t i = 0; i < E.numrows; i++) {
+    current += direction;
+    if (current < 0)
+      current = E.numrows - 1;
+    else if (current >= E.numrows)
+      current = 0;
+    if (E.pager) {
+      // look at the raw bytes first so only matching lines get materialized.
+      size_t len;
+      if (strstr(pagerReadLine(E.pager, current, &len), query) == NULL)
+        continue;
+    }
+    erow *row = editorRow(current);
+    char *match = strstr(row->render, query);
+    if (match) {
+      last_match = current;
+      E.cy = current;
+      E.cx = editorRowMap(row, MAP_RB, MAP_CX, match - row->render);
+      E.rowoff = E.numrows;
+
+      E.match_row = current;
+      E.match_off = match - row->render;
+      E.match_len = strlen(query);
+      break;
+    }
+  }
+}
+void editorFind() {
+  size_t saved_cx = E.cx;
+  int64_t saved_cy = E.cy;
+  size_t saved_colooff = E.coloff;
+  int64_t saved_rowoff = E.rowoff;
+  size_t saved_wrapoff = E.wrapoff;
+
+  char *query =
+      editorPrompt("Search: %s (Use ESC to cancel | Arrows to navigate ) ",
+                   editorFindCallBack);
+  if (query) {
+    free(query);
+  } else {
+    E.cx = saved_cx;
+    E.cy = saved_cy;
+    E.coloff = saved_colooff;
+    E.rowoff = saved_rowoff;
+    E.wrapoff = saved_wrapoff;
+    if (E.cy > E.numrows)
+      E.cy = E.numrows;
+    editorClampCursor();
+  }
+}
+
+/*** go to */
+
+// Ctrl-G takes a line number, a byte offset ending in 'b' or a percentage
+// of the lines ending in '%', and puts the cursor there directly; only the
+// rows that end up on screen are read or laid out. paged files look the
+// byte offset up in the line index, other files add up row sizes.
+
+// PAGER_WARM rows before a jump target in a paged file are highlighted
+// first when there is no comment checkpoint above it yet, so a multiline
+// comment that starts above the screen most likely shows.
+#define PAGER_WARM 256
+
+// editorRowAtByte() returns the row holding byte off of the file and sets
+// *col to the offset in that row. rows that are not paged are added up with
+// the line ending of the file's first line, as the editor drops the \r of
+// \r\n line endings when it reads a file; in a file that mixes the two the
+// offsets are only exact up to the first line that ends differently.
+int64_t editorRowAtByte(off_t off, size_t *col) {
+  int64_t at = 0;
+  off_t start = 0;
+  if (E.pager) {
+    int64_t lo = 0, hi = E.pager->numlines;
+    while (lo < hi) {
+      int64_t mid = lo + (hi - lo) / 2;
+      if (E.pager->lineoff[mid] <= off)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    at = lo > 0 ? lo - 1 : 0;
+    start = E.pager->numlines ? E.pager->lineoff[at] : 0;
+  } else {
+    size_t eol = E.disk.crlf ? 2 : 1;
+    while (at < E.numrows - 1 && start + (off_t)(E.row[at].size + eol) <= off)
+      start += E.row[at++].size + eol;
+  }
+  *col = off > start ? off - start : 0;
+  return at;
+}
+
+// editorJump() moves the cursor to row at, column cx, with the row in the
+// middle of the screen.
+void editorJump(int64_t at, size_t cx) {
+  if (at >= E.numrows)
+    at = E.numrows > 0 ? E.numrows - 1 : 0;
+  if (at < 0)
+    at = 0;
+  if (E.pager && E.syntax && at < E.numrows) {
+    int64_t top = at - E.screenrows / 2;
+    if (top > 0 &&
+        pagerCommentAt(E.pager, top - top % PAGER_CHECKPOINT_LINES) == -1) {
+      for (int64_t j = top - PAGER_WARM > 0 ? top - PAGER_WARM : 0; j < top;
+           j++)
+        editorRow(j);
+    }
+  }
+  E.cy = at;
+  E.cx = cx;
+  E.rowoff = at > E.screenrows / 2 ? at - E.screenrows / 2 : 0;
+  E.wrapoff = 0;
+  editorClampCursor();
+}
+
+void editorGoto() {
+  char *answer = editorPrompt(
+      "Go to: %s (line, 123b for a byte offset, 45%% of lines; ESC to cancel)",
+      NULL);
+  if (answer == NULL)
+    return;
+  char *end;
+  errno = 0;
+  long long n = strtoll(answer, &end, 10);
+  if (errno || end == answer || n < 0 ||
+      (*end && strcmp(end, "b") && strcmp(end, "%"))) {
+    editorSetStatusMessage("Can't go to %.40s", answer);
+    free(answer);
+    return;
+  }
+
+  if (*end == 'b') {
+    size_t col;
+    int64_t at = editorRowAtByte(n, &col);
+    editorJump(at, col);
+  } else if (*end == '%') {
+    editorJump(E.numrows > 0 ? (E.numrows - 1) * (n > 100 ? 100 : n) / 100 : 0,
+               0);
+  } else {
+    editorJump(n > 0 ? n - 1 : 0, 0);
+  }
+  free(answer);
+}
+
+/*** symbols */
+
+// Ctrl-O jumps to where a function, struct, union, enum, class, typedef or
+// macro of a C file is defined, picked by a fuzzy match on its name. the
+// index is a list of symbols sorted by row. rows are read with their
+// highlighting, so names in comments and strings are skipped for free, and
+// a row is indexed again every time it is highlighted again; inserting and
+// deleting rows moves the symbols after them. a file is indexed in slices
+// while idle, from E.sym.scan on, and the prompt does the rest at once if it
+// is used before that is done. a query is matched against every name, but
+// a name missing one of the query's characters is skipped after one test of
+// its mask.
+
+enum symbolKind {
+  SYM_FUNCTION,
+  SYM_STRUCT,
+  SYM_UNION,
+  SYM_ENUM,
+  SYM_CLASS,
+  SYM_TYPEDEF,
+  SYM_MACRO
+};
+
+char *SYMBOL_KINDS[] = {"function", "struct", "union", "enum",
+                        "class",    "typedef", "macro"};
+
+// words that are followed by a parenthesis without being a function.
+char *SYMBOL_NOT_FUNCTIONS[] = {"if",     "while",  "for", "switch",
+                                "return", "sizeof", NULL};
+
+int symbolActive() {
+  return E.syntax && E.syntax->filematch == C_HL_extensions && !E.pager &&
+         !E.hex;
+}
+
+void symbolReset() {
+  E.sym.buf = -1;
+  E.words.buf = -1;
+  E.sym.n = 0;
+  E.sym.len = 0;
+  E.sym.garbage = 0;
+  E.sym.scan = 0;
+}
+
+// symbolMask() has a bit for each letter in s, ignoring case, one for
+// digits and one for anything else.
+uint32_t symbolMask(const char *s, size_t len) {
+  uint32_t m = 0;
+  for (size_t i = 0; i < len; i++) {
+    int c = tolower((unsigned char)s[i]);
+    if (c >= 'a' && c <= 'z')
+      m |= 1u << (c - 'a');
+    else if (isdigit(c))
+      m |= 1u << 26;
+    else
+      m |= 1u << 27;
+  }
+  return m;
+}
+
+// symbolFirst() returns the first symbol on row at or after it.
+int64_t symbolFirst(struct editorSymbols *s, int64_t at) {
+  int64_t lo = 0, hi = s->n;
+  while (lo < hi) {
+    int64_t mid = lo + (hi - lo) / 2;
+    if (s->sym[mid].row < at)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// symbolCode() returns the render of row with comments and strings blanked
+// out, in a buffer that is reused.
+char *symbolCode(erow *row) {
+  static char *code = NULL;
+  static size_t cap = 0;
+  if (row->rsize + 1 > cap) {
+    cap = (row->rsize + 1) * 2;
+    code = realloc(code, cap);
+    if (code == NULL)
+      die("realloc");
+  }
+  memcpy(code, row->render, row->rsize);
+  code[row->rsize] = '\0';
+  size_t at = 0;
+  for (uint32_t j = 0; j < row->nhl; j++) {
+    int hl = row->hl[j].hl;
+    if (hl == HL_COMMENT || hl == HL_MLCOMMENT || hl == HL_STRING)
+      memset(&code[at], ' ', row->hl[j].len);
+    at += row->hl[j].len;
+  }
+  return code;
+}
+
+int symbolIsIdent(int c) { return isalnum(c) || c == '_' || c == '$'; }
+
+size_t symbolSkipSpace(const char *s, size_t i) {
+  while (s[i] == ' ' || s[i] == '\t')
+    i++;
+  return i;
+}
+
+size_t symbolWordEnd(const char *s, size_t i) {
+  while (symbolIsIdent((unsigned char)s[i]))
+    i++;
+  return i;
+}
+
+int symbolWordIs(const char *s, size_t len, const char *w) {
+  return strlen(w) == len && !strncmp(s, w, len);
+}
+
+// symbolAdd() adds the name s[from..to) to the n symbols found in a row so
+// far and returns how many there are now.
+int symbolAdd(struct editorSymbol *out, int n, const char *s, size_t from,
+              size_t to, int kind) {
+  if (n == SYMBOL_ROW_MAX || to == from || isdigit((unsigned char)s[from]))
+    return n;
+  out[n].off = from;
+  out[n].len = to - from;
+  out[n].kind = kind;
+  return n + 1;
+}
+
+// symbolFind() finds the definitions in a row, at most SYMBOL_ROW_MAX. a
+// function is a name followed by a parenthesis at the start of a row,
+// after its type, on a row that does not end in a semicolon. struct, union,
+// enum and class take a name followed by a brace or the end of the row, and
+// a row starting with "} name;" names a typedef.
+int symbolFind(erow *row, struct editorSymbol *out) {
+  if (row->lr || row->rsize == 0)
+    return 0;
+  char *s = symbolCode(row);
+  int n = 0;
+  size_t i = symbolSkipSpace(s, 0);
+
+
+  if (s[i] == '#') {
+    i = symbolSkipSpace(s, i + 1);
+    if (!strncmp(&s[i], "define", 6) &&
+        (s[i + 6] == ' ' || s[i + 6] == '\t')) {
+      i = symbolSkipSpace(s, i + 6);
+      n = symbolAdd(out, n, s, i, symbolWordEnd(s, i), SYM_MACRO);
+    }
+    return n;
+  }
+  if (s[i] == '}') {
+    size_t from = symbolSkipSpace(s, i + 1), to = symbolWordEnd(s, from);
+    if (s[symbolSkipSpace(s, to)] == ';')
+      n = symbolAdd(out, n, s, from, to, SYM_TYPEDEF);
+    return n;
+  }
+
+  for (size_t j = i; s[j];) {
+    if (!symbolIsIdent((unsigned char)s[j])) {
+      j++;
+      continue;
+    }
+    size_t e = symbolWordEnd(s, j);
+    int kind = -1;
+    if (symbolWordIs(&s[j], e - j, "struct"))
+      kind = SYM_STRUCT;
+    else if (symbolWordIs(&s[j], e - j, "union"))
+      kind = SYM_UNION;
+    else if (symbolWordIs(&s[j], e - j, "enum"))
+      kind = SYM_ENUM;
+    else if (symbolWordIs(&s[j], e - j, "class"))
+      kind = SYM_CLASS;
+    else if (symbolWordIs(&s[j], e - j, "function"))
+      kind = SYM_FUNCTION;
+    if (kind != -1) {
+      size_t from = symbolSkipSpace(s, e), to = symbolWordEnd(s, from);
+      char next = s[symbolSkipSpace(s, to)];
+      if (kind == SYM_FUNCTION ? next == '('
+                               : next == '{' || next == ':' || next == '\0' ||
+                                     (kind == SYM_CLASS && symbolIsIdent(next)))
+        n = symbolAdd(out, n, s, from, to, kind);
+    }
+    j = e;
+  }
+  if (n > 0 || i > 0 || !symbolIsIdent((unsigned char)s[0]))
+    return n;
+
+  char *paren = strchr(s, '(');
+  if (paren == NULL || memchr(s, '=', paren - s))
+    return 0;
+  size_t last = row->rsize;
+  while (last > 0 && (s[last - 1] == ' ' || s[last - 1] == '\t'))
+    last--;
+  if (last > 0 && s[last - 1] == ';')
+    return 0;
+  size_t to = paren - s;
+  while (to > 0 && s[to - 1] == ' ')
+    to--;
+  size_t from = to;
+  while (from > 0 && symbolIsIdent((unsigned char)s[from - 1]))
+    from--;
+  if (from == 0)
+    return 0;
+  // a name with nothing before it is a call or a macro, not a definition.
+  for (int k = 0; SYMBOL_NOT_FUNCTIONS[k]; k++) {
+    if (symbolWordIs(&s[from], to - from, SYMBOL_NOT_FUNCTIONS[k]))
+      return 0;
+  }
+  n = symbolAdd(out, n, s, from, to, SYM_FUNCTION);
+  return n;
+}
+
+// symbolCompact() drops the names that are not used any more.
+void symbolCompact(struct editorSymbols *s) {
+  char *names = malloc(s->len - s->garbage + 1);
+  if (names == NULL)
+    die("malloc");
+  size_t len = 0;
+  for (int64_t j = 0; j < s->n; j++) {
+    memcpy(&names[len], &s->names[s->sym[j].name], s->sym[j].len);
+    s->sym[j].name = len;
+    len += s->sym[j].len;
+  }
+  free(s->names);
+  s->names = names;
+  s->len = len;
+  s->namecap = len + 1;
+  s->garbage = 0;
+}
+
+// symbolScan() indexes row at again.
+void symbolScan(int64_t at) {
+  struct editorSymbols *s = &E.sym;
+  erow *row = &E.row[at];
+  struct editorSymbol found[SYMBOL_ROW_MAX];
+  int n = symbolFind(row, found);
+
+  int64_t lo = symbolFirst(s, at), hi = lo;
+  while (hi < s->n && s->sym[hi].row == at)
+    s->garbage += s->sym[hi++].len;
+  if (n == 0 && hi == lo)
+    return;
+  if (s->n - (hi - lo) + n > s->cap) {
+    s->cap = s->cap ? s->cap * 2 : 1024;
+    s->sym = realloc(s->sym, s->cap * sizeof(struct editorSymbol));
+    if (s->sym == NULL)
+      die("realloc");
+  }
+  memmove(&s->sym[lo + n], &s->sym[hi],
+          (s->n - hi) * sizeof(struct editorSymbol));
+  s->n += n - (hi - lo);
+
+  for (int k = 0; k < n; k++) {
+    struct editorSymbol *sym = &s->sym[lo + k];
+    *sym = found[k];
+    if (sym->len > SYMBOL_NAME_MAX)
+      sym->len = SYMBOL_NAME_MAX;
+    if (s->len + sym->len > s->namecap) {
+      s->namecap = (s->len + sym->len) * 2;
+      s->names = realloc(s->names, s->namecap);
+      if (s->names == NULL)
+        die("realloc");
+    }
+    memcpy(&s->names[s->len], &row->render[sym->off], sym->len);
+    sym->row = at;
+    sym->name = s->len;
+    sym->mask = symbolMask(&s->names[s->len], sym->len);
+    s->len += sym->len;
+  }
+  if (s->garbage > 64 * 1024 && s->garbage > s->len / 2)
+    symbolCompact(s);
 }
 
-void editorInsertNewline() {
-  if (E.cx == 0) {
-    editorInsertRow(E.cy, "", 0);
-  } else {
-    erow *row = &E.row[E.cy];
-    editorInsertRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
-    row = &E.row[E.cy];
-    row->size = E.cx;
-    row->chars[row->size] = '\0';
-    // the '\0' character is used to terminate the string.
-    editorUpdateRow(row);
+// symbolRow() is called when row was highlighted again. rows that the idle
+// indexing did not get to yet are left to it.
+void symbolRow(erow *row) {
+  struct editorSymbols *s = &E.sym;
+  if (s->buf == E.curbuf && s->syntax == E.syntax && row->idx < s->scan &&
+      row >= E.row && row < E.row + E.numrows)
+    symbolScan(row->idx);
+}
+
+// symbolShift() drops the symbols of del rows at at and moves the ones after
+// them to where they are once ins rows were put in their place.
+void symbolShift(int64_t at, int64_t del, int64_t ins) {
+  struct editorSymbols *s = &E.sym;
+  if (s->buf != E.curbuf || s->scan <= at)
+    return;
+  int64_t lo = symbolFirst(s, at), hi = symbolFirst(s, at + del);
+  for (int64_t j = lo; j < hi; j++)
+    s->garbage += s->sym[j].len;
+  if (hi < s->n)
+    memmove(&s->sym[lo], &s->sym[hi],
+            (s->n - hi) * sizeof(struct editorSymbol));
+  s->n -= hi - lo;
+  for (int64_t j = lo; j < s->n; j++)
+    s->sym[j].row += ins - del;
+  s->scan = s->scan >= at + del ? s->scan + ins - del : at;
+}
+
+// symbolWork() indexes rows for about budget nanoseconds, or until it is
+// done with a budget of 0.
+void symbolWork(int64_t budget) {
+  struct editorSymbols *s = &E.sym;
+  if (!symbolActive()) {
+    if (s->buf != -1)
+      symbolReset();
+    return;
+  }
+  if (s->buf != E.curbuf || s->syntax != E.syntax) {
+    symbolReset();
+    s->buf = E.curbuf;
+    s->syntax = E.syntax;
   }
+  int64_t deadline = editorNow() + budget;
+  while (s->scan < E.numrows) {
+    symbolScan(s->scan++);
+    if (budget && s->scan % 256 == 0 && editorNow() > deadline)
+      return;
+  }
+}
 
-  E.cy++;
-  E.cx = 0;
+// symbolScore() scores name as a match for q: all of q has to be in name in
+// order, ignoring case. characters that start the name or a word in it,
+// runs of characters and the same case score more, and shorter names win
+// ties. it returns -1 when name does not match.
+int symbolScore(const char *name, size_t len, const char *q) {
+  int score = 0, run = 0;
+  size_t i = 0;
+  for (; *q; q++, i++) {
+    int c = tolower((unsigned char)*q);
+    while (i < len && tolower((unsigned char)name[i]) != c) {
+      i++;
+      run = 0;
+    }
+    if (i == len)
+      return -1;
+    int prev = i > 0 ? (unsigned char)name[i - 1] : 0;
+    if (i == 0 || prev == '_' ||
+        (islower(prev) && isupper((unsigned char)name[i])))
+      score += 8;
+    if (run)
+      score += 4;
+    if (name[i] == *q)
+      score++;
+    run = 1;
+  }
+  return score * 256 - (int)len;
 }
 
-void editorDelChar() {
-  if (E.cy == E.numrows)
+// symbolMatch() puts the SYMBOL_MATCHES best matches for q in best, best
+// first and in row order between equals, and returns how many there are.
+int symbolMatch(const char *q, int64_t *best) {
+  struct editorSymbols *s = &E.sym;
+  int score[SYMBOL_MATCHES];
+  int n = 0;
+  uint32_t mask = symbolMask(q, strlen(q));
+  for (int64_t j = 0; j < s->n; j++) {
+    struct editorSymbol *sym = &s->sym[j];
+    if (mask & ~sym->mask)
+      continue;
+    int sc = symbolScore(&s->names[sym->name], sym->len, q);
+    if (sc < 0 || (n == SYMBOL_MATCHES && sc <= score[n - 1]))
+      continue;
+    int k = n < SYMBOL_MATCHES ? n++ : n - 1;
+    while (k > 0 && score[k - 1] < sc) {
+      score[k] = score[k - 1];
+      best[k] = best[k - 1];
+      k--;
+    }
+    score[k] = sc;
+    best[k] = j;
+  }
+  return n;
+}
+
+void editorSymbolCallback(char *query, int key) {
+  static int which = 0;
+  E.match_row = -1;
+  if (key == '\x1b') {
+    which = 0;
     return;
-  if (E.cx == 0 && E.cy == 0) {
+  } else if (key == Arrow_Right || key == Arrow_Down) {
+    which++;
+  } else if (key == Arrow_Left || key == Arrow_Up) {
+    which--;
+  } else if (key != '\r') {
+    which = 0;
+  }
+
+  symbolWork(0);
+  // the rows the idle indexing did not get to yet.
+  int64_t best[SYMBOL_MATCHES];
+  int n = query[0] ? symbolMatch(query, best) : 0;
+  if (n == 0) {
+    if (key == '\r') {
+      editorSetStatusMessage("No symbol matches %.40s", query);
+      which = 0;
+    }
     return;
   }
-  erow *row = &E.row[E.cy];
-  if (E.cx > 0) {
-    editorRowDelChar(row, E.cx - 1);
-    E.cx--;
+  which = (which % n + n) % n;
+  struct editorSymbol *sym = &E.sym.sym[best[which]];
+  editorJump(sym->row, editorRowMap(editorRow(sym->row), MAP_RB, MAP_CX,
+                                    sym->off));
+  if (key == '\r') {
+    editorSetStatusMessage("%s %.*s, line %" PRId64, SYMBOL_KINDS[sym->kind],
+                           (int)(sym->len > 40 ? 40 : sym->len),
+                           &E.sym.names[sym->name], sym->row + 1);
+    which = 0;
+    return;
+  }
+  E.match_row = sym->row;
+  E.match_off = sym->off;
+  E.match_len = sym->len;
+}
+
+void editorSymbols() {
+  if (!symbolActive()) {
+    editorSetStatusMessage("Symbols are only indexed for C files");
+    return;
+  }
+  size_t saved_cx = E.cx;
+  int64_t saved_cy = E.cy;
+  size_t saved_coloff = E.coloff;
+  int64_t saved_rowoff = E.rowoff;
+  size_t saved_wrapoff = E.wrapoff;
+
+  char *query = editorPrompt(
+      "Symbol: %s (ESC to cancel | Arrows for other matches)",
+      editorSymbolCallback);
+  if (query) {
+    free(query);
   } else {
-    E.cx = E.row[E.cy - 1].size;
-    editorRowAppendString(&E.row[E.cy - 1], row->chars, row->size);
-    editorDelRow(E.cy);
-    E.cy--;
+    E.cx = saved_cx;
+    E.cy = saved_cy;
+    E.coloff = saved_coloff;
+    E.rowoff = saved_rowoff;
+    E.wrapoff = saved_wrapoff;
+    if (E.cy > E.numrows)
+      E.cy = E.numrows;
+    editorClampCursor();
   }
 }
-/*** file i/o */
 
-char *editorRowsString(int *buflen) {
-  int totlen = 0;
-  int j;
-  for (j = 0; j < E.numrows; j++) {
-    totlen += E.row[j].size + 1;
+/*** completion */
+
+// Ctrl-Y completes the word before the cursor with the most frequent word
+// in the open files that starts with it, and pressing it again swaps in the
+// next one. while typing a word the message bar shows the best candidates.
+// the words are counted in a trie: each node is a word, its count how often
+// it is in the rows and max the highest count of a word starting with it,
+// so the best completions are found by following max down from the prefix
+// without looking at the rest of the trie. a file's rows are counted while
+// idle, like the symbols. after that editorUpdateRow() counts the words of
+// a row's new text, and the functions that change a row's text take its old
+// words out first. words_counted makes sure each row is in the counts
+// exactly once however often it is laid out again. nothing is counted until
+// completion is first used, and nodes of words that are no longer in the
+// rows are reused, so the trie only holds the words that are there now.
+// tokens that look like numbers, ids or hashes are left out, a log full of
+// them would otherwise be a trie of words that are each seen once.
+
+int wordIsChar(int c) { return isalnum(c) || c == '_'; }
+
+// wordIsNumber() tells whether a token is mostly digits, or only hex digits
+// with at least one digit.
+int wordIsNumber(const char *s, size_t len) {
+  size_t digits = 0, hex = 0;
+  for (size_t i = 0; i < len; i++) {
+    digits += isdigit((unsigned char)s[i]) != 0;
+    hex += isxdigit((unsigned char)s[i]) != 0;
   }
-  *buflen = totlen;
+  return digits * 2 >= len || (digits > 0 && hex == len);
+}
 
-  char *buf = malloc(totlen);
-  char *p = buf;
+uint32_t wordSlot(int32_t parent, unsigned char c) {
+  return ((uint32_t)parent * 0x9e3779b1u) ^ (c * 0x85ebca6bu);
+}
 
-  for (j = 0; j < E.numrows; j++) {
-    memcpy(p, E.row[j].chars, E.row[j].size);
-    p += E.row[j].size;
-    *p = '\n';
-    p++;
+// wordGrowSlots() doubles the hash of nodes by parent and character.
+void wordGrowSlots(struct editorWords *w) {
+  uint32_t n = w->nslot ? w->nslot * 2 : 4096;
+  int32_t *slot = calloc(n, sizeof(int32_t));
+  if (slot == NULL)
+    die("calloc");
+  for (int32_t i = 1; i < w->nnode; i++) {
+    if (w->node[i].parent == -1)
+      continue;
+    // unused, see wordFree().
+    uint32_t h = wordSlot(w->node[i].parent, w->node[i].c) & (n - 1);
+    while (slot[h])
+      h = (h + 1) & (n - 1);
+    slot[h] = i + 1;
   }
-
-  return buf;
+  free(w->slot);
+  w->slot = slot;
+  w->nslot = n;
 }
 
-void editorOpen(char *filename) {
-  free(E.filename);
-  E.filename = strdup(filename);
+// wordChild() returns the node for parent followed by c, making it when
+// create is set, or -1.
+int32_t wordChild(struct editorWords *w, int32_t parent, unsigned char c,
+                  int create) {
+  if (w->nslot == 0) {
+    if (!create)
+      return -1;
+    wordGrowSlots(w);
+  }
+  uint32_t h = wordSlot(parent, c) & (w->nslot - 1);
+  for (; w->slot[h]; h = (h + 1) & (w->nslot - 1)) {
+    struct wordNode *n = &w->node[w->slot[h] - 1];
+    if (n->parent == parent && n->c == c)
+      return w->slot[h] - 1;
+  }
+  if (!create || (w->nfree == -1 && w->nnode >= WORD_MAX_NODES))
+    return -1;
 
-  editorSelectSyntaxHighlight();
-  // strdup() is used to duplicate a string.
-  FILE *fp = fopen(filename, "r");
-  if (!fp) {
-    die("fopen");
+  int32_t i = w->nfree;
+  if (i != -1) {
+    w->nfree = w->node[i].sibling;
+  } else if (w->nnode == w->nodecap) {
+    w->nodecap = w->nodecap ? w->nodecap * 2 : 4096;
+    w->node = realloc(w->node, w->nodecap * sizeof(struct wordNode));
+    if (w->node == NULL)
+      die("realloc");
   }
-  char *line = NULL;
-  size_t linecap = 0;
-  ssize_t linelen;
+  if (i == -1)
+    i = w->nnode++;
+  struct wordNode *n = &w->node[i];
+  n->parent = parent;
+  n->child = -1;
+  n->sibling = w->node[parent].child;
+  n->count = 0;
+  n->max = 0;
+  n->c = c;
+  w->node[parent].child = i;
+  w->slot[h] = i + 1;
+  if ((uint32_t)w->nnode * 2 > w->nslot)
+    wordGrowSlots(w);
+  return i;
+}
 
-  while ((linelen = getline(&line, &linecap, fp)) != -1) {
-    while (linelen > 0 &&
-           (line[linelen - 1] == '\n' || line[linelen - 1] == '\r')) {
-      linelen--;
+// wordFree() takes node i, which has no children, out of the trie and puts
+// it on the list of unused nodes.
+void wordFree(struct editorWords *w, int32_t i) {
+  struct wordNode *n = &w->node[i];
+  int32_t *link = &w->node[n->parent].child;
+  while (*link != i)
+    link = &w->node[*link].sibling;
+  *link = n->sibling;
+
+  // the slots are probed linearly, so the nodes after the hole that would
+  // no longer be found past it move back into it.
+  uint32_t mask = w->nslot - 1;
+  uint32_t h = wordSlot(n->parent, n->c) & mask;
+  while (w->slot[h] != i + 1)
+    h = (h + 1) & mask;
+  for (uint32_t j = (h + 1) & mask; w->slot[j]; j = (j + 1) & mask) {
+    struct wordNode *m = &w->node[w->slot[j] - 1];
+    uint32_t home = wordSlot(m->parent, m->c) & mask;
+    if (((j - home) & mask) >= ((j - h) & mask)) {
+      w->slot[h] = w->slot[j];
+      h = j;
     }
-    editorInsertRow(E.numrows, line, linelen);
   }
-  free(line);
-  fclose(fp);
-  E.dirty = 0;
+  w->slot[h] = 0;
+
+  n->parent = -1;
+  n->sibling = w->nfree;
+  w->nfree = i;
 }
 
-void editorSave() {
+// wordPrune() frees node at and the nodes above it while they are neither
+// a counted word nor the start of one.
+void wordPrune(struct editorWords *w, int32_t at) {
+  while (at > 0 && w->node[at].count == 0 && w->node[at].child == -1) {
+    int32_t parent = w->node[at].parent;
+    wordFree(w, at);
+    at = parent;
+  }
+}
 
-  if (E.filename == NULL) {
-    E.filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
-    if (E.filename == NULL) {
-      editorSetStatusMessage("Save aborted");
-      return;
+// wordAdd() counts the word s delta more times, delta being 1 or -1.
+void wordAdd(const char *s, size_t len, int delta) {
+  struct editorWords *w = &E.words;
+  if (w->nnode == 0) {
+    w->nodecap = 4096;
+    w->node = malloc(w->nodecap * sizeof(struct wordNode));
+    if (w->node == NULL)
+      die("malloc");
+    memset(&w->node[0], 0, sizeof(struct wordNode));
+    w->node[0].parent = -1;
+    w->node[0].child = -1;
+    w->nnode = 1;
+    w->nfree = -1;
+  }
+  int32_t at = 0, last = 0;
+  for (size_t i = 0; i < len && at != -1; i++) {
+    at = wordChild(w, at, s[i], delta > 0);
+    if (at != -1)
+      last = at;
+  }
+  if (at == -1) {
+    wordPrune(w, last);
+    return;
+  }
+  // a word that did not fit in the trie is not counted at all.
+  if (delta < 0 && w->node[at].count == 0)
+    return;
+
+  struct wordNode *n = &w->node[at];
+  n->count += delta;
+  w->total += delta;
+  if (delta > 0) {
+    for (int32_t j = at; j != -1 && w->node[j].max < n->count;
+         j = w->node[j].parent)
+      w->node[j].max = n->count;
+    return;
+  }
+  for (int32_t j = at; j != -1; j = w->node[j].parent) {
+    uint32_t max = w->node[j].count;
+    for (int32_t k = w->node[j].child; k != -1; k = w->node[k].sibling) {
+      if (w->node[k].max > max)
+        max = w->node[k].max;
     }
-    editorSelectSyntaxHighlight();
+    if (w->node[j].max == max)
+      break;
+    w->node[j].max = max;
   }
+  wordPrune(w, at);
+}
 
-  int len;
-  char *buf = editorRowsString(&len);
+// wordsRow() counts the words of row delta more times.
+void wordsRow(erow *row, int delta) {
+  const char *s = row->chars, *end = row->chars + row->size;
+  while (s < end) {
+    if (!wordIsChar((unsigned char)*s)) {
+      s++;
+      continue;
+    }
+    const char *start = s;
+    while (s < end && wordIsChar((unsigned char)*s))
+      s++;
+    size_t len = s - start;
+    if (len >= WORD_MIN && len <= WORD_MAX &&
+        !isdigit((unsigned char)*start) && !wordIsNumber(start, len))
+      wordAdd(start, len, delta);
+  }
+}
 
-  int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
+// wordsCount() counts the words of a row that was laid out again. rows
+// that the idle counting did not get to yet are left to it.
+void wordsCount(erow *row) {
+  if (row->words_counted || E.pager || E.words.buf != E.curbuf ||
+      row->idx >= E.words.scan)
+    return;
+  wordsRow(row, 1);
+  row->words_counted = 1;
+}
 
-  // open is a system call that opens a file.
-  // the O_RDWR flag is used to open the file for reading and writing.
-  // the O_CREAT flag is used to create the file if it does not exist.
-  // the 0644 is the file permissions.
-  // which is read and write for the user, and read for the group and others.
+void wordsForget(erow *row) {
+  if (!row->words_counted)
+    return;
+  wordsRow(row, -1);
+  row->words_counted = 0;
+}
 
-  if (fd != -1) {
-    // ftruncate() is used to truncate a file to a specified length.
-    // the fd is the file descriptor.
-    // len is the length of the file.
-    if (ftruncate(fd, len) != 1) {
-      // write() is used to write to a file.
-      // the fd is the file descriptor.
-      // the buf is the buffer of data.
-      // the len is the length of the data.
+// wordEntry is a node waiting in wordsComplete()'s heap, highest key first.
+struct wordEntry {
+  uint32_t key;
+  int32_t node;
+  int word; // the word at node itself rather than the ones under it.
+};
 
-      if (write(fd, buf, len) == len) {
-        close(fd);
-        free(buf);
-        E.dirty = 0;
-        editorSetStatusMessage("%d bytes written to disk", len);
-        return;
-      }
+// wordPush() adds an entry to the heap, unless its key is 0 or the heap is
+// full.
+void wordPush(struct wordEntry *heap, int *n, uint32_t key, int32_t node,
+              int word) {
+  if (key == 0 || *n == WORD_HEAP)
+    return;
+  int h = (*n)++;
+  for (; h > 0 && heap[(h - 1) / 2].key < key; h = (h - 1) / 2)
+    heap[h] = heap[(h - 1) / 2];
+  heap[h].key = key;
+  heap[h].node = node;
+  heap[h].word = word;
+}
+
+struct wordEntry wordPop(struct wordEntry *heap, int *n) {
+  struct wordEntry top = heap[0], last = heap[--*n];
+  int h = 0;
+  while (2 * h + 1 < *n) {
+    int c = 2 * h + 1;
+    if (c + 1 < *n && heap[c + 1].key > heap[c].key)
+      c++;
+    if (heap[c].key <= last.key)
+      break;
+    heap[h] = heap[c];
+    h = c;
+  }
+  heap[h] = last;
+  return top;
+}
+
+// wordsWork() counts the rows that are not counted yet for about budget
+// nanoseconds, or until it is done with a budget of 0.
+void wordsWork(int64_t budget) {
+  struct editorWords *w = &E.words;
+  if (!w->on || E.pager || E.hex)
+    return;
+  if (w->buf != E.curbuf) {
+    // the rows of the other buffers stay counted.
+    w->buf = E.curbuf;
+    w->scan = 0;
+  }
+  int64_t deadline = editorNow() + budget;
+  while (w->scan < E.numrows) {
+    erow *row = &E.row[w->scan++];
+    if (!row->words_counted) {
+      wordsRow(row, 1);
+      row->words_counted = 1;
     }
-    close(fd);
+    if (budget && w->scan % 256 == 0 && editorNow() > deadline)
+      return;
   }
-  free(buf);
-  editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
 }
 
-// find
+// wordsComplete() puts up to max words that start with prefix and are
+// longer in out, most frequent first, and returns how many there are. the
+// trie is searched best first: a node's max is the best count of any word
+// under it, so words come out in order as soon as they are reached.
+int wordsComplete(const char *prefix, size_t plen,
+                  char out[][WORD_MAX + 1], int max) {
+  struct editorWords *w = &E.words;
+  int32_t at = w->nnode ? 0 : -1;
+  for (size_t i = 0; i < plen && at != -1; i++)
+    at = wordChild(w, at, prefix[i], 0);
+  if (at == -1)
+    return 0;
 
-void editorFindCallBack(char *query, int key) {
-  static int last_match = -1;
-  // static is used to make a variable persist between function calls.
-  static int direction = 1;
+  struct wordEntry heap[WORD_HEAP], e;
+  int nheap = 0, n = 0;
+  for (int32_t k = w->node[at].child; k != -1; k = w->node[k].sibling)
+    wordPush(heap, &nheap, w->node[k].max, k, 0);
+  while (nheap > 0 && n < max) {
+    e = wordPop(heap, &nheap);
+    struct wordNode *node = &w->node[e.node];
+    if (e.word) {
+      size_t len = 0;
+      for (int32_t j = e.node; j > 0; j = w->node[j].parent)
+        len++;
+      if (len > WORD_MAX)
+        continue;
+      out[n][len] = '\0';
+      for (int32_t j = e.node; j > 0; j = w->node[j].parent)
+        out[n][--len] = w->node[j].c;
+      n++;
+      continue;
+    }
+    wordPush(heap, &nheap, node->count, e.node, 1);
+    for (int32_t k = node->child; k != -1; k = w->node[k].sibling)
+      wordPush(heap, &nheap, w->node[k].max, k, 0);
+  }
+  return n;
+}
 
-  static int saved_hl_line;
-  static char *saved_hl = NULL;
+// editorWordStart() returns where the word that ends at the cursor starts,
+// or E.cx when there is none to complete.
+size_t editorWordStart() {
+  if (E.cy >= E.numrows || E.pager || E.hex)
+    return E.cx;
+  erow *row = &E.row[E.cy];
+  if (E.cx < row->size && wordIsChar((unsigned char)row->chars[E.cx]))
+    return E.cx;
+  size_t start = E.cx;
+  while (start > 0 && wordIsChar((unsigned char)row->chars[start - 1]))
+    start--;
+  if (E.cx - start > WORD_MAX || isdigit((unsigned char)row->chars[start]))
+    return E.cx;
+  return start;
+}
 
-  if (saved_hl) {
-    memcpy(E.row[saved_hl_line].hl, saved_hl, E.row[saved_hl_line].rsize);
-    free(saved_hl);
-    saved_hl = NULL;
+// editorCompleteHint() shows the best completions of the word being typed
+// in the message bar. when there are none it takes down the last message
+// about completions, unless something else was shown since.
+void editorCompleteHint() {
+  char cand[WORD_CANDIDATES][WORD_MAX + 1];
+  size_t start = editorWordStart();
+  int n = 0;
+  if (E.cx - start >= 2) {
+    E.words.on = 1;
+    n = wordsComplete(&E.row[E.cy].chars[start], E.cx - start, cand, 3);
   }
-  if (key == '\r' || key == '\x1b') {
-    last_match = -1;
-    direction = 1;
-
+  // the first word typed starts the counting, it has candidates once the
+  // rows are counted while idle.
+  if (n == 0) {
+    if (E.words.hint[0] && !strcmp(E.statusmsg, E.words.hint))
+      editorSetStatusMessage("");
+    E.words.hint[0] = '\0';
     return;
-  } else if (key == Arrow_Right || key == Arrow_Down) {
-    direction = 1;
-  } else if (key == Arrow_Left || key == Arrow_Up) {
-    direction = -1;
+  }
+  editorSetStatusMessage("Ctrl-Y: %s%s%s%s%s", cand[0], n > 1 ? " | " : "",
+                         n > 1 ? cand[1] : "", n > 2 ? " | " : "",
+                         n > 2 ? cand[2] : "");
+  memcpy(E.words.hint, E.statusmsg, sizeof(E.words.hint));
+}
+
+// editorComplete() is Ctrl-Y: it completes the word before the cursor, or
+// replaces the completion it just made with the next candidate.
+void editorComplete() {
+  struct editorWords *w = &E.words;
+  if (w->ncand > 0 && w->cy == E.cy && w->cx == E.cx) {
+    while (E.cx > w->start + w->plen)
+      editorDelChar();
+    w->which = (w->which + 1) % w->ncand;
   } else {
-    last_match = -1;
-    direction = 1;
+    size_t start = editorWordStart();
+    if (E.cx == start) {
+      editorSetStatusMessage("Nothing to complete");
+      return;
+    }
+    w->on = 1;
+    wordsWork(0);
+    // the rows the idle counting did not get to yet.
+    w->ncand = wordsComplete(&E.row[E.cy].chars[start], E.cx - start,
+                             w->cand, WORD_CANDIDATES);
+    if (w->ncand == 0) {
+      editorSetStatusMessage("No completions");
+      return;
+    }
+    w->which = 0;
+    w->start = start;
+    w->plen = E.cx - start;
   }
+  for (const char *s = &w->cand[w->which][w->plen]; *s; s++)
+    editorInsertChars((unsigned char)*s);
+  w->cy = E.cy;
+  w->cx = E.cx;
+  editorSetStatusMessage("%s (%d/%d%s)", w->cand[w->which], w->which + 1,
+                         w->ncand, w->ncand > 1 ? ", Ctrl-Y for the next" : "");
+  memcpy(w->hint, E.statusmsg, sizeof(w->hint));
+}
 
-  if (last_match == -1)
-    direction = 1;
+/*** replace */
+
+// replace-all works on chars, one row at a time: the matches in a row are
+// counted first, the new text is built in one allocation of the final size,
+// and the old text is kept in E.undo. rows are laid out and highlighted
+// again only once all of them have their new text, each exactly once, see
+// editorUpdateReplaced(). undoing swaps the old and the new text back in the
+// same way, so Ctrl-Z again redoes the change.
+
+// editorMemFind() returns the first q in s, or NULL.
+const char *editorMemFind(const char *s, size_t len, const char *q,
+                          size_t qlen) {
+  const char *end = s + len;
+  while ((size_t)(end - s) >= qlen) {
+    s = memchr(s, q[0], end - s - qlen + 1);
+    if (s == NULL || memcmp(s, q, qlen) == 0)
+      return s;
+    s++;
+  }
+  return NULL;
+}
+
+void editorUndoFree() {
+  free(E.undo.rows);
+  free(E.undo.ends);
+  free(E.undo.text);
+  memset(&E.undo, 0, sizeof(E.undo));
+}
 
-  int current = last_match;
+// editorUndoSave() keeps the text of a row that is about to change in u.
+void editorUndoSave(struct editorUndo *u, erow *row) {
+  if ((u->nrows & (u->nrows - 1)) == 0) {
+    // nrows is zero or a power of two, time to double.
+    size_t n = u->nrows ? u->nrows * 2 : 1;
+    u->rows = realloc(u->rows, n * sizeof(int64_t));
+    u->ends = realloc(u->ends, n * sizeof(size_t));
+    if (u->rows == NULL || u->ends == NULL)
+      die("realloc");
+  }
+  if (u->len + row->size > u->cap) {
+    u->cap = u->cap * 2 > u->len + row->size ? u->cap * 2
+                                             : u->len + row->size + 4096;
+    u->text = realloc(u->text, u->cap);
+    if (u->text == NULL)
+      die("realloc");
+  }
+  if (row->size)
+    memcpy(&u->text[u->len], row->chars, row->size);
+  // text is still NULL when the first rows saved are empty.
+  u->len += row->size;
+  u->rows[u->nrows] = row->idx;
+  u->ends[u->nrows++] = u->len;
+}
 
-  for (int i = 0; i < E.numrows; i++) {
-    current += direction;
-    if (current == -1)
-      current = E.numrows - 1;
-    else if (current == E.numrows)
-      current = 0;
-    erow *row = &E.row[current];
-    char *match = strstr(row->render, query);
-    if (match) {
-      last_match = current;
-      E.cy = current;
-      E.cx = editorRowRxToCx(row, match - row->render);
-      E.rowoff = E.numrows;
+// editorRowSetChars() gives a row new text, of which the first keep bytes
+// are the same as before. it returns the old text, which render may still
+// point into until the row is laid out again.
+char *editorRowSetChars(erow *row, char *chars, size_t size, size_t keep,
+                        int ascii) {
+  char *old = row->chars;
+  wordsForget(row);
+  if (row->lr)
+    longRowEdit(row, keep, row->size - keep, size - keep, ascii);
+  row->chars = chars;
+  row->size = size;
+  return old;
+}
 
-      saved_hl_line = current;
-      saved_hl = malloc(row->rsize);
-      memcpy(saved_hl, row->hl, row->rsize);
-      memset(&row->hl[match - row->render], HL_MATCH, strlen(query));
-      break;
+// editorUpdateReplaced() lays out and highlights the rows in u, which all
+// have their new text, in order and each once. a comment that one of them
+// opens or closes is carried on into the rows below it only up to the next
+// one in u, which starts from there when its turn comes. the rows' old text
+// in old, whose lengths u has, is freed after that, as the render of a row
+// not laid out yet may still point into it.
+void editorUpdateReplaced(struct editorUndo *u, char **old) {
+  for (int64_t i = 0; i < u->nrows; i++) {
+    E.hl_stop = i + 1 < u->nrows ? u->rows[i + 1] : -1;
+    editorUpdateRow(&E.row[u->rows[i]]);
+  }
+  E.hl_stop = -1;
+  size_t start = 0;
+  for (int64_t i = 0; i < u->nrows; i++) {
+    rowFree(old[i], u->ends[i] - start + 1);
+    start = u->ends[i];
+  }
+}
+
+// editorReplaceAll() replaces every query in the document with rep. it
+// returns the number of replacements.
+int64_t editorReplaceAll(const char *query, const char *rep) {
+  size_t qlen = strlen(query), rlen = strlen(rep);
+  int ascii = editorAsciiPrefix(rep, rlen) == rlen;
+  int64_t t = TRACE_BEGIN();
+  struct editorUndo u = {0};
+  char **old = NULL;
+
+  for (int64_t j = 0; j < E.numrows; j++) {
+    erow *row = &E.row[j];
+    const char *first = editorMemFind(row->chars, row->size, query, qlen);
+    if (first == NULL)
+      continue;
+    size_t n = 0;
+    for (const char *m = first; m; m = editorMemFind(m + qlen,
+                                                     row->chars + row->size -
+                                                         m - qlen,
+                                                     query, qlen))
+      n++;
+
+    size_t size = row->size - n * qlen + n * rlen;
+    char *out = rowAlloc(size + 1);
+    const char *from = row->chars, *end = row->chars + row->size;
+    char *to = out;
+    for (const char *m = first; m; m = editorMemFind(from, end - from, query,
+                                                     qlen)) {
+      memcpy(to, from, m - from);
+      to += m - from;
+      memcpy(to, rep, rlen);
+      to += rlen;
+      from = m + qlen;
+    }
+    memcpy(to, from, end - from);
+    out[size] = '\0';
+
+    if ((u.nrows & (u.nrows - 1)) == 0) {
+      old = realloc(old, (u.nrows ? u.nrows * 2 : 1) * sizeof(char *));
+      if (old == NULL)
+        die("realloc");
     }
+    // old grows the way editorUndoSave() grows u.
+    editorUndoSave(&u, row);
+    old[u.nrows - 1] =
+        editorRowSetChars(row, out, size, first - row->chars, ascii);
+    u.count += n;
   }
+  editorUpdateReplaced(&u, old);
+  free(old);
+
+  if (u.nrows) {
+    editorUndoFree();
+    E.undo = u;
+    E.dirty++;
+  }
+  E.match_row = -1;
+  TRACE_END("replace all", t);
+  return u.count;
 }
-void editorFind() {
-  int saved_cx = E.cx;
-  int saved_cy = E.cy;
-  int saved_colooff = E.coloff;
-  int saved_rowoff = E.rowoff;
 
-  char *query =
-      editorPrompt("Search: %s (Use ESC to cancel | Arrows to navigate ) ",
-                   editorFindCallBack);
-  if (query) {
+// editorUndoApply() swaps the text of the rows in E.undo with what they had
+// before, which undoes the last replace-all or redoes it.
+void editorUndoApply() {
+  if (E.undo.nrows == 0) {
+    editorSetStatusMessage("Nothing to undo");
+    return;
+  }
+  struct editorUndo u = {0};
+  char **old = malloc(E.undo.nrows * sizeof(char *));
+  if (old == NULL)
+    die("malloc");
+  size_t start = 0;
+  for (int64_t i = 0; i < E.undo.nrows; i++) {
+    erow *row = &E.row[E.undo.rows[i]];
+    size_t size = E.undo.ends[i] - start;
+    char *chars = rowAlloc(size + 1);
+    memcpy(chars, &E.undo.text[start], size);
+    chars[size] = '\0';
+    start = E.undo.ends[i];
+    editorUndoSave(&u, row);
+    old[i] = editorRowSetChars(row, chars, size, 0, 0);
+  }
+  editorUpdateReplaced(&u, old);
+  free(old);
+
+  u.count = E.undo.count;
+  u.undone = !E.undo.undone;
+  editorUndoFree();
+  E.undo = u;
+  E.dirty++;
+  E.match_row = -1;
+  if (E.cy < E.numrows && E.cx > E.row[E.cy].size)
+    E.cx = E.row[E.cy].size;
+  editorSetStatusMessage("%s %" PRId64 " replacements in %" PRId64
+                         " lines, Ctrl-Z again to %s",
+                         u.undone ? "Undid" : "Redid", u.count, u.nrows,
+                         u.undone ? "redo" : "undo");
+}
+
+void editorReplace() {
+  size_t saved_cx = E.cx;
+  int64_t saved_cy = E.cy;
+  size_t saved_coloff = E.coloff;
+  int64_t saved_rowoff = E.rowoff;
+  size_t saved_wrapoff = E.wrapoff;
+
+  char *query = editorPrompt("Replace: %s (ESC to cancel)", editorFindCallBack);
+  char *rep = NULL;
+  if (query)
+    rep = editorPromptFlags("Replace with: %s (ESC to cancel)", NULL,
+                            PROMPT_EMPTY);
+  E.cx = saved_cx;
+  E.cy = saved_cy;
+  E.coloff = saved_coloff;
+  E.rowoff = saved_rowoff;
+  E.wrapoff = saved_wrapoff;
+  if (E.cy > E.numrows)
+    E.cy = E.numrows;
+  editorClampCursor();
+  if (rep == NULL) {
     free(query);
-  } else {
-    E.cx = saved_cx;
-    E.cy = saved_cy;
-    E.coloff = saved_colooff;
-    E.rowoff = saved_rowoff;
+    editorSetStatusMessage("Replace aborted");
+    return;
   }
+
+  int64_t count = editorReplaceAll(query, rep);
+  if (E.cy < E.numrows && E.cx > E.row[E.cy].size)
+    E.cx = E.row[E.cy].size;
+  if (count)
+    editorSetStatusMessage("Replaced %" PRId64 " occurrences in %" PRId64
+                           " lines, Ctrl-Z to undo",
+                           count, E.undo.nrows);
+  else
+    editorSetStatusMessage("No occurrences of %.40s", query);
+  free(query);
+  free(rep);
 }
 
 //** append buff */
 
 struct abuf {
   char *b;
-  int len;
+  size_t len;
 };
 
 #define ABUF_INIT {NULL, 0}
@@ -878,7 +5893,7 @@ struct abuf {
 // {NULL, 0} is the initializer for the abuf struct.
 // the abuf struct is used to store the buffer and the length of the buffer.
 
-void abAppend(struct abuf *ab, const char *s, int len) {
+void abAppend(struct abuf *ab, const char *s, size_t len) {
   char *new = realloc(ab->b, ab->len + len);
   // the realloc() function is used to allocate memory.
   // the ab->b is the buffer.
@@ -899,6 +5914,12 @@ void abFree(struct abuf *ab) { free(ab->b); }
 /** input ***/
 
 char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
+  return editorPromptFlags(prompt, callback, 0);
+}
+
+// editorPromptFlags() is editorPrompt() with PROMPT_* flags.
+char *editorPromptFlags(char *prompt, void (*callback)(char *, int),
+                        int flags) {
   size_t bufsize = 128;
   // size_t is an unsigned integer type that is used to represent the size of
   // objects in bytes.
@@ -906,6 +5927,7 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
 
   size_t buflen = 0;
   buf[0] = '\0';
+  E.prompting++;
 
   while (1) {
     editorSetStatusMessage(prompt, buf);
@@ -917,20 +5939,22 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
         buf[--buflen] = '\0';
     } else if (c == '\x1b') {
       editorSetStatusMessage("");
+      E.prompting--;
       if (callback)
         callback(buf, c);
       free(buf);
       return NULL;
     } else if (c == '\r') {
       // which is enter.
-      if (buflen != 0) {
+      if (buflen != 0 || (flags & PROMPT_EMPTY)) {
         editorSetStatusMessage("");
+        E.prompting--;
         if (callback)
           callback(buf, c);
 
         return buf;
       }
-    } else if (!iscntrl(c) && c < 128) {
+    } else if (c < 256 && (c >= 128 || !iscntrl(c))) {
       if (buflen == bufsize - 1) {
         bufsize *= 2;
         buf = realloc(buf, bufsize);
@@ -959,19 +5983,19 @@ void editorSetStatusMessage(const char *fmt, ...) {
 }
 
 void editorMoveCursor(int key) {
-  erow *row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+  erow *row = (E.cy >= E.numrows) ? NULL : editorRow(E.cy);
   switch (key) {
   case Arrow_Left:
     if (E.cx != 0) {
-      E.cx--;
+      E.cx = editorRowPrevChar(row, E.cx);
     } else if (E.cy > 0) {
       E.cy--;
-      E.cx = E.row[E.cy].size;
+      E.cx = editorRow(E.cy)->size;
     }
     break;
   case Arrow_Right:
     if (row && E.cx < row->size) {
-      E.cx++;
+      E.cx = editorRowNextChar(row, E.cx);
     } else if (row && E.cx == row->size) {
       E.cy++;
       E.cx = 0;
@@ -990,21 +6014,92 @@ void editorMoveCursor(int key) {
     break;
   }
 
-  row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
-  int rowlen = row ? row->size : 0;
+  editorClampCursor();
+}
+
+// editorClampCursor() moves the cursor back inside its row.
+void editorClampCursor() {
+  erow *row = (E.cy >= E.numrows) ? NULL : editorRow(E.cy);
+  size_t rowlen = row ? row->size : 0;
 
   if (E.cx > rowlen) {
     E.cx = rowlen;
   }
+  if (row && E.cx < rowlen)
+    E.cx = editorRowCharStart(row, E.cx);
+  // moving between rows must not leave the cursor inside a character.
+}
+
+// editorIsEditKey() tells whether a key would change the document.
+int editorIsEditKey(int c) {
+  switch (c) {
+  case '\r':
+  case Back_Space:
+  case CTRL_KEY('h'):
+  case Del_Key:
+    return 1;
+  case CTRL_KEY('q'):
+  case CTRL_KEY('s'):
+  case CTRL_KEY('f'):
+  case CTRL_KEY('l'):
+  case CTRL_KEY('p'):
+  case CTRL_KEY('t'):
+  case CTRL_KEY('w'):
+  case CTRL_KEY('n'):
+  case CTRL_KEY('b'):
+  case CTRL_KEY('e'):
+  case CTRL_KEY('g'):
+  case CTRL_KEY('x'):
+  case CTRL_KEY('o'):
+  case CTRL_KEY('d'):
+  case '\x1b':
+  case HOME_KEY:
+  case END_KEY:
+  case Page_Up:
+  case Page_Down:
+  case Arrow_Up:
+  case Arrow_Down:
+  case Arrow_Left:
+  case Arrow_Right:
+    return 0;
+  default:
+    return 1;
+  }
 }
 
-void editorProcessKeypress() {
+void editorHandleKey(int c) {
 
-  //  editorProcessKeypress() is to process the keypresses that the editor
+  //  editorHandleKey() is to process the keypresses that the editor
   //  reads.
 
   static int quit_times = EDITOR_QUIT_TIMES;
-  int c = editorReadKey();
+
+  if (editorIsEditKey(c) && c != CTRL_KEY('z') && c != CTRL_KEY('r'))
+    editorUndoFree();
+  // only the last replace-all can be undone, and only until the next edit.
+  if (c != CTRL_KEY('y'))
+    E.words.ncand = 0;
+  // Ctrl-Y only takes the next candidate right after the last one.
+
+  if (E.hex && hexHandleKey(c)) {
+    quit_times = EDITOR_QUIT_TIMES;
+    return;
+  }
+  if (E.pager && editorIsEditKey(c)) {
+    editorSetStatusMessage("Read-only: file is opened in paging mode");
+    return;
+  }
+  if (E.stream.fd != -1 && editorIsEditKey(c)) {
+    editorSetStatusMessage("Read-only while the file is being read");
+    return;
+  }
+  if ((E.follow.on || E.follow.dropped) && editorIsEditKey(c)) {
+    editorSetStatusMessage(E.follow.on ? "Read-only while following, Ctrl-E "
+                                         "to stop"
+                                       : "Read-only: lines were dropped from "
+                                         "the top in follow mode");
+    return;
+  }
 
   switch (c) {
 
@@ -1015,15 +6110,20 @@ void editorProcessKeypress() {
 
   case CTRL_KEY('q'):
 
-    if (E.dirty && quit_times > 0) {
+    if (E.session) {
+      // the buffers stay in the server, unsaved changes included.
+      write(E.outfd, "\x1b[2J\x1b[H", 7);
+      editorDetach();
+    }
+    if (editorAnyDirty() && quit_times > 0) {
       editorSetStatusMessage("WARNING!!! File has unsaved changes. Press "
                              "Ctrl-Q %d more times to quit.",
                              quit_times);
       quit_times--;
       return;
     }
-    write(STDOUT_FILENO, "\x1b[2J", 4);
-    write(STDOUT_FILENO, "\x1b[H", 3);
+    write(E.outfd, "\x1b[2J", 4);
+    write(E.outfd, "\x1b[H", 3);
     exit(0);
     break;
 
@@ -1036,35 +6136,108 @@ void editorProcessKeypress() {
     break;
   case END_KEY:
     if (E.cy < E.numrows)
-      E.cx = E.row[E.cy].size;
+      E.cx = editorRow(E.cy)->size;
     break;
 
   case CTRL_KEY('f'):
     editorFind();
     break;
 
+  case CTRL_KEY('p'):
+    // the HUD takes two lines from the text area while it is shown.
+    if (!E.hud.on && E.screenrows <= 2)
+      break;
+    E.hud.on = !E.hud.on;
+    E.screenrows += E.hud.on ? -2 : 2;
+    E.hud.key_time = 0;
+    E.hud.hl_time = 0;
+    E.hud.mem_time = 0;
+    break;
+
+  case CTRL_KEY('n'):
+  case CTRL_KEY('b'):
+    if (E.nbuf > 1)
+      editorSwitchBuffer((E.curbuf + (c == CTRL_KEY('n') ? 1 : E.nbuf - 1)) %
+                         E.nbuf);
+    break;
+
+  case CTRL_KEY('e'):
+    editorToggleFollow();
+    break;
+
+  case CTRL_KEY('r'):
+    editorReplace();
+    break;
+
+  case CTRL_KEY('g'):
+    editorGoto();
+    break;
+
+  case CTRL_KEY('x'):
+    editorToggleHex();
+    break;
+
+  case CTRL_KEY('o'):
+    editorSymbols();
+    break;
+
+  case CTRL_KEY('y'):
+    editorComplete();
+    break;
+
+  case CTRL_KEY('d'):
+    editorToggleDiff();
+    break;
+
+  case CTRL_KEY('z'):
+    editorUndoApply();
+    break;
+
+  case CTRL_KEY('w'):
+    E.softwrap = !E.softwrap;
+    E.coloff = 0;
+    E.wrapoff = 0;
+    editorSetStatusMessage("Soft wrap %s", E.softwrap ? "on" : "off");
+    break;
+
+  case CTRL_KEY('t'):
+    if (E.trace == NULL) {
+      traceStart(TRACE_DEFAULT_FILE);
+      editorSetStatusMessage("Tracing, Ctrl-T again writes %s",
+                             E.trace->filename);
+    } else if (traceDump() == 0) {
+      editorSetStatusMessage("Trace written to %s", E.trace->filename);
+    } else {
+      editorSetStatusMessage("Can't write trace! I/O error: %s",
+                             strerror(errno));
+    }
+    break;
+
   case Back_Space:
   case CTRL_KEY('h'): // the 'h' character is the backspace character.
   case Del_Key:
     if (c == Del_Key)
       editorMoveCursor(Arrow_Right);
     editorDelChar();
+    editorCompleteHint();
     break;
 
   case Page_Up:
-  case Page_Down: {
+  case Page_Down:
+    // a screen up or down from the top or bottom row, the same as moving
+    // the cursor E.screenrows times without touching the rows in between.
     if (c == Page_Up) {
-      E.cy = E.rowoff;
-    } else if (c == Page_Down) {
+      E.cy = E.rowoff > E.screenrows ? E.rowoff - E.screenrows : 0;
+    } else {
       E.cy = E.rowoff + E.screenrows - 1;
       if (E.cy > E.numrows)
         E.cy = E.numrows;
+      if (E.cy < E.numrows - 1)
+        E.cy = E.cy + E.screenrows < E.numrows - 1 ? E.cy + E.screenrows
+                                                   : E.numrows - 1;
     }
-    int times = E.screenrows;
-    while (times--) {
-      editorMoveCursor(c == Page_Up ? Arrow_Up : Arrow_Down);
-    }
-  } break;
+    editorClampCursor();
+    break;
 
   case Arrow_Down:
   case Arrow_Up:
@@ -1079,19 +6252,135 @@ void editorProcessKeypress() {
 
   default:
     editorInsertChars(c);
+    editorCompleteHint();
     break;
   }
 
   quit_times = EDITOR_QUIT_TIMES;
 }
 
+void editorProcessKeypress() {
+  int c = editorReadKey();
+  int64_t start = TRACE_BEGIN();
+  editorHandleKey(c);
+  TRACE_END("process key", start);
+}
+
 /** output */
 
+// with soft wrap on, a row is shown as screen lines of screencols columns,
+// and editorRowSegments() says how many. a line ends early before a wide
+// character that does not fit on it, which starts the next line instead.
+// the last line always has room for the cursor past the end of the row.
+// nothing about the wrapping is stored, it is worked out for the rows near
+// the screen when they are needed.
+
+// editorSegmentNext() returns the column where the screen line of row that
+// starts at column start ends.
+size_t editorSegmentNext(erow *row, size_t start) {
+  size_t end = start + E.screencols;
+  if (row->cols == NULL)
+    return end;
+  size_t next = editorRowMap(row, MAP_RB, MAP_RX,
+                             editorRowMap(row, MAP_RX, MAP_RB, end));
+  // next is where the character on column end starts.
+  return next > start ? next : end;
+}
+
+// editorSegmentAt() returns the screen line of row that column rx is on,
+// and sets *start to the column that line starts at.
+size_t editorSegmentAt(erow *row, size_t rx, size_t *start) {
+  size_t seg = 0, col = 0, next;
+  if (row->cols == NULL) {
+    seg = rx / E.screencols;
+    col = seg * E.screencols;
+  } else {
+    while ((next = editorSegmentNext(row, col)) <= rx) {
+      col = next;
+      seg++;
+    }
+  }
+  if (start)
+    *start = col;
+  return seg;
+}
+
+size_t editorRowSegments(erow *row) {
+  size_t width = editorRowMap(row, MAP_RB, MAP_RX, row->rsize);
+  return editorSegmentAt(row, width, NULL) + 1;
+}
+
+size_t editorSegmentsAt(int64_t at) {
+  return at < E.numrows ? editorRowSegments(editorRow(at)) : 1;
+}
+
+// editorCursorSegment() is the screen line of the cursor row that the
+// cursor is on, *start is set to where it starts.
+size_t editorCursorSegment(size_t *start) {
+  if (E.cy < E.numrows)
+    return editorSegmentAt(editorRow(E.cy), E.rx, start);
+  *start = 0;
+  return 0;
+}
+
+void editorScrollWrapped() {
+  size_t start;
+  size_t seg = editorCursorSegment(&start);
+  E.coloff = 0;
+  if (E.cy < E.rowoff || (E.cy == E.rowoff && seg < E.wrapoff)) {
+    E.rowoff = E.cy;
+    E.wrapoff = seg;
+    return;
+  }
+
+  // walk back screenrows - 1 lines from the cursor to find the highest top
+  // that still shows it.
+  int64_t top = E.cy;
+  size_t lines = E.screenrows - 1;
+  while (lines > 0) {
+    if (seg >= lines) {
+      seg -= lines;
+      break;
+    }
+    lines -= seg + 1;
+    if (top == 0 || top - 1 < E.rowoff) {
+      seg = 0;
+      break;
+    }
+    top--;
+    seg = editorSegmentsAt(top) - 1;
+  }
+  if (top > E.rowoff || (top == E.rowoff && seg > E.wrapoff)) {
+    E.rowoff = top;
+    E.wrapoff = seg;
+  }
+}
+
+// editorScreenY() is the screen line of the cursor.
+int editorScreenY() {
+  if (!E.softwrap)
+    return E.cy - E.rowoff;
+  int y = 0;
+  for (int64_t r = E.rowoff; r < E.cy; r++)
+    y += editorSegmentsAt(r) - (r == E.rowoff ? E.wrapoff : 0);
+  size_t start;
+  return y + editorCursorSegment(&start) - (E.cy == E.rowoff ? E.wrapoff : 0);
+}
+
 void editorScroll() {
+  if (E.hex) {
+    hexScroll();
+    return;
+  }
   E.rx = 0;
 
   if (E.cy < E.numrows) {
-    E.rx = editorRowsCxToRx(&E.row[E.cy], E.cx);
+    E.rx = editorRowsCxToRx(editorRow(E.cy), E.cx);
+  }
+
+  if (E.softwrap) {
+    editorScrollWrapped();
+    return;
   }
 
   if (E.cy < E.rowoff) {
@@ -1109,13 +6398,183 @@ void editorScroll() {
   }
 }
 
+// editorDrawRow() draws the part of row that starts at screen column coloff.
+void editorDrawRow(struct abuf *ab, erow *row, int64_t filerow,
+                   size_t coloff) {
+  char *c = row->render;
+  size_t rb = editorRowMap(row, MAP_RX, MAP_RB, coloff);
+  // rb is the render byte shown in the first screen column.
+  int width = editorRowMap(row, MAP_RB, MAP_RX, rb) - coloff;
+  if (width < 0 && rb < row->rsize) {
+    // a wide character is cut by the left edge, show its right half as
+    // blanks.
+    uint32_t cp;
+    int clen = utf8Decode(&c[rb], row->rsize - rb, &cp);
+    width += editorCharWidth(cp);
+    rb += clen ? clen : 1;
+    for (int k = 0; k < width; k++)
+      abAppend(ab, " ", 1);
+  }
+  if (width < 0)
+    width = 0;
+
+  unsigned char *whl = NULL;
+  size_t wstart = 0;
+  if (row->lr && E.syntax) {
+    // long rows are only highlighted where they are on screen.
+    size_t from = editorRowMap(row, MAP_RB, MAP_CX, rb);
+    size_t to = editorRowRxToCx(row, coloff + E.screencols) + 4;
+    whl = longRowWindow(row, from, to, &wstart);
+  }
+
+  int current_color = -1;
+  size_t span = 0;
+  size_t spanend = row->nhl ? row->hl[0].len : 0;
+  // spanend is the render offset just past the current highlight span.
+  while (rb < row->rsize && width < E.screencols) {
+    unsigned char ch = c[rb];
+    size_t clen = 1;
+    int w = 1;
+    if (ch >= 0x80) {
+      // render only holds valid UTF-8 here, see editorLayoutRow().
+      uint32_t cp;
+      clen = utf8Decode(&c[rb], row->rsize - rb, &cp);
+      if (clen == 0)
+        clen = 1;
+      w = editorCharWidth(cp);
+      if (width + w > E.screencols)
+        break;
+    }
+
+    while (span < row->nhl && rb >= spanend) {
+      span++;
+      if (span < row->nhl)
+        spanend += row->hl[span].len;
+    }
+    int hl = span < row->nhl ? (int)row->hl[span].hl : HL_NORMAL;
+    if (whl)
+      hl = whl[editorRowMap(row, MAP_RB, MAP_CX, rb) - wstart];
+    if (filerow == E.match_row && rb >= E.match_off &&
+        rb < E.match_off + E.match_len)
+      hl = HL_MATCH;
+
+    if (ch < 0x20 || ch == 0x7f) {
+      char sym = (ch <= 26) ? '@' + ch : '?';
+      abAppend(ab, "\x1b[7m", 4);
+      abAppend(ab, &sym, 1);
+      abAppend(ab, "\x1b[m", 3);
+      if(current_color != -1){
+        char buf[16];
+        int blen = snprintf(buf, sizeof(buf), "\x1b[%dm",current_color);
+        abAppend(ab,buf,blen);
+      }
+    } else if (hl == HL_NORMAL) {
+      if (current_color != -1) {
+        abAppend(ab, "\x1b[39m", 5);
+        current_color = -1;
+      }
+      abAppend(ab, &c[rb], clen);
+    } else {
+      int color = editorSyntaxToColor(hl);
+      if (color != current_color) {
+        current_color = color;
+        char buf[16];
+        int blen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
+        abAppend(ab, buf, blen);
+      }
+      abAppend(ab, &c[rb], clen);
+    }
+    rb += clen;
+    width += w;
+  }
+  abAppend(ab, "\x1b[39m", 5);
+}
+
+// hexDrawRows() is editorDrawRows() for the hex view.
+void hexDrawRows(struct abuf *ab) {
+  struct editorHex *h = E.hex;
+  int width = hexWidth(h), digits = hexDigits(h);
+  char buf[32];
+  for (int y = 0; y < E.screenrows; y++) {
+    off_t off = h->top + (off_t)y * width;
+    if (off >= h->size) {
+      abAppend(ab, y == 0 && h->size == 0 ? "~ (empty file)" : "~",
+               y == 0 && h->size == 0 ? 14 : 1);
+      abAppend(ab, "\x1b[K\r\n", 5);
+      continue;
+    }
+    int n = snprintf(buf, sizeof(buf), "%0*" PRIx64 "  ", digits,
+                     (uint64_t)off);
+    abAppend(ab, buf, n);
+
+    size_t e = hexEdited(h, off);
+    for (int pass = 0; pass < 2; pass++) {
+      // the hex column, then the ASCII one.
+      size_t k = e;
+      for (int i = 0; i < width; i++) {
+        off_t at = off + i;
+        if (at >= h->size) {
+          if (pass == 0)
+            abAppend(ab, i % 8 == 7 ? "    " : "   ", i % 8 == 7 ? 4 : 3);
+          continue;
+        }
+        unsigned char c = h->map[at];
+        while (k < h->nedits && h->edits[k] < at)
+          k++;
+        int edited = k < h->nedits && h->edits[k] == at;
+        int other = at == h->cur && h->ascii == !pass;
+        // the byte under the cursor is marked in the column it is not in.
+        if (edited || other) {
+          n = snprintf(buf, sizeof(buf), "\x1b[%s%dm", other ? "7;" : "",
+                       edited ? editorSyntaxToColor(HL_MATCH) : 39);
+          abAppend(ab, buf, n);
+        }
+        if (pass == 0) {
+          n = snprintf(buf, sizeof(buf), "%02x", c);
+          abAppend(ab, buf, n);
+        } else {
+          char ch = c >= 0x20 && c < 0x7f ? c : '.';
+          abAppend(ab, &ch, 1);
+        }
+        if (edited || other)
+          abAppend(ab, "\x1b[m", 3);
+        if (pass == 0)
+          abAppend(ab, i % 8 == 7 ? "  " : " ", i % 8 == 7 ? 2 : 1);
+      }
+      if (pass == 0 && width % 8)
+        abAppend(ab, " ", 1);
+    }
+    abAppend(ab, "\x1b[K\r\n", 5);
+  }
+}
+
+// diffDrawGutter() draws the diff mark of row at, blanks if it has none.
+void diffDrawGutter(struct abuf *ab, int64_t at) {
+  unsigned char mark = at >= 0 && at < E.diff.nmark ? E.diff.mark[at] : 0;
+  const char *s = mark & DIFF_ADDED         ? "\x1b[32m+\x1b[39m "
+                  : mark & DIFF_CHANGED     ? "\x1b[33m~\x1b[39m "
+                  : mark & DIFF_DELETED     ? "\x1b[31m-\x1b[39m "
+                  : mark & DIFF_DELETED_END ? "\x1b[31m_\x1b[39m "
+                                            : "  ";
+  abAppend(ab, s, strlen(s));
+}
+
 void editorDrawRows(struct abuf *ab) {
+  if (E.hex) {
+    hexDrawRows(ab);
+    return;
+  }
 
   // this loop is to draw the rows of tildes.
   int y;
+  int64_t filerow = E.rowoff;
+  size_t seg = E.wrapoff, segcol = 0, segs = 0;
+  // with soft wrap on, seg is the screen line of filerow being drawn,
+  // segcol the column it starts at and segs how many filerow has.
 
   for (y = 0; y < E.screenrows; y++) {
-    int filerow = y + E.rowoff;
+    if (E.diff.on)
+      diffDrawGutter(ab, E.softwrap && seg > 0 ? -1 : filerow);
 
     if (filerow >= E.numrows) {
       if (E.numrows == 0 && y == E.screenrows / 3) {
@@ -1139,43 +6598,24 @@ void editorDrawRows(struct abuf *ab) {
         abAppend(ab, "~", 1);
       }
     } else {
-      int len = E.row[filerow].rsize - E.coloff;
-      if (len < 0)
-        len = 0;
-      if (len > E.screencols)
-        len = E.screencols;
-      char *c = &E.row[filerow].render[E.coloff];
-      int current_color = -1;
-      unsigned char *hl = &E.row[filerow].hl[E.coloff];
-      for (int j = 0; j < len; j++) {
-        if (iscntrl(c[j])) {
-          char sym = (c[j] <= 26) ? '@' + c[j] : '?';
-          abAppend(ab, "\x1b[7m", 4);
-          abAppend(ab, &sym, 1);
-          abAppend(ab, "\x1b[m", 3);
-          if(current_color != -1){
-            char buf[16];
-            int clen = snprintf(buf, sizeof(buf), "\x1b[%dm",current_color);
-            abAppend(ab,buf,clen);
-          }
-        } else if (hl[j] == HL_NORMAL) {
-          if (current_color != -1) {
-            abAppend(ab, "\x1b[39m", 5);
-            current_color = -1;
-          }
-          abAppend(ab, &c[j], 1);
-        } else {
-          int color = editorSyntaxToColor(hl[j]);
-          if (color != current_color) {
-            current_color = color;
-            char buf[16];
-            int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
-            abAppend(ab, buf, clen);
-          }
-          abAppend(ab, &c[j], 1);
+      erow *row = editorRow(filerow);
+      if (E.softwrap) {
+        if (segs == 0) {
+          segs = editorRowSegments(row);
+          segcol = row->cols ? 0 : seg * E.screencols;
+          for (size_t k = 0; row->cols && k < seg; k++)
+            segcol = editorSegmentNext(row, segcol);
         }
+        editorDrawRow(ab, row, filerow, segcol);
+        segcol = editorSegmentNext(row, segcol);
+        if (++seg >= segs) {
+          filerow++;
+          seg = 0;
+          segs = 0;
+        }
+      } else {
+        editorDrawRow(ab, row, filerow++, E.coloff);
       }
-      abAppend(ab, "\x1b[39m", 5);
     }
     abAppend(ab, "\x1b[K", 3);
     // the 'K' command is used to clear the line.
@@ -1184,23 +6624,134 @@ void editorDrawRows(struct abuf *ab) {
   // this if statement is to check if we are on the last row.
   // if we are not on the last row, we print a newline character.
 }
+// editorBarWidth() is the width of the HUD, status and message lines,
+// which also span the diff gutter.
+int editorBarWidth() {
+  return E.screencols + (E.diff.on ? DIFF_GUTTER : 0);
+}
+
+// editorHudMemory() adds up the row memory by kind. walking every row is not
+// free on big files, so it runs at most once a second.
+void editorHudMemory() {
+  struct editorHud *h = &E.hud;
+  int64_t now = editorNow();
+  if (h->mem_time && now - h->mem_time < 1000000000)
+    return;
+  h->mem_time = now;
+
+  long pages = 0;
+  FILE *fp = fopen("/proc/self/statm", "r");
+  if (fp) {
+    if (fscanf(fp, "%*s %ld", &pages) != 1)
+      pages = 0;
+    fclose(fp);
+  }
+  h->rss = pages * sysconf(_SC_PAGESIZE);
+
+  h->mem_rows = h->mem_text = h->mem_render = h->mem_hl = h->mem_cols = 0;
+  erow *rows = E.row;
+  int64_t n = E.numrows;
+  if (E.pager) {
+    rows = E.pager->row;
+    n = PAGER_ROWS;
+    h->mem_rows = (E.pager->numlines + 1) * sizeof(off_t);
+  } else {
+    h->mem_rows = n * sizeof(erow);
+  }
+  for (int64_t j = 0; j < n; j++) {
+    erow *row = &rows[j];
+    if (row->chars == NULL)
+      continue;
+    h->mem_text += row->size + 1;
+    if (!row->render_shared)
+      h->mem_render += row->rsize + 1;
+    h->mem_hl += row->nhl * sizeof(hlspan);
+    if (row->lr)
+      h->mem_hl += row->lr->chkcap * sizeof(struct hlCheckpoint);
+    h->mem_cols += editorColsSize(row->cols);
+  }
+  h->mem_undo = E.undo.cap + E.undo.nrows * (sizeof(int64_t) + sizeof(size_t));
+}
+
+void editorDrawHud(struct abuf *ab) {
+  int cols = editorBarWidth();
+  struct editorHud *h = &E.hud;
+  char line[2][160];
+  editorHudMemory();
+
+  snprintf(line[0], sizeof(line[0]),
+           " frame %.3f ms (build %.3f, write %.3f) %zu B | hl %.3f ms | "
+           "input->paint %.3f ms",
+           (h->build + h->write) / 1e6, h->build / 1e6, h->write / 1e6,
+           h->bytes, h->hl_time / 1e6, h->latency / 1e6);
+  snprintf(line[1], sizeof(line[1]),
+           " RSS %.1f MB | rows %.1f, text %.1f, render %.1f, hl %.1f, "
+           "cols %.1f, undo %.1f MB",
+           h->rss / 1e6, h->mem_rows / 1e6, h->mem_text / 1e6,
+           h->mem_render / 1e6, h->mem_hl / 1e6, h->mem_cols / 1e6,
+           h->mem_undo / 1e6);
+
+  for (int i = 0; i < 2; i++) {
+    int len = strlen(line[i]);
+    if (len > cols)
+      len = cols;
+    abAppend(ab, "\x1b[K", 3);
+    abAppend(ab, line[i], len);
+    abAppend(ab, "\r\n", 2);
+  }
+}
+
 void editorDrawStatusBar(struct abuf *ab) {
+  int cols = editorBarWidth();
 
   // this function is to draw the status bar.
   // 7m is the command to invert the colors.
   abAppend(ab, "\x1b[7m", 4);
   char status[90], rstatus[90]; /// this number is the length of the status bar.
-  int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
-                     E.filename ? E.filename : "[No Name]", E.numrows,
-                     E.dirty ? "(modified)" : "");
-  int rlen =
-      snprintf(rstatus, sizeof(rstatus), "%s |  %d/%d",
-               E.syntax ? E.syntax->filetype : "no ft", E.cy + 1, E.numrows);
-  if (len > E.screencols)
-    len = E.screencols;
+  char reading[32] = "";
+  if (E.stream.fd != -1) {
+    if (E.stream.size)
+      snprintf(reading, sizeof(reading), "(reading %d%%) ",
+               (int)(E.stream.bytes * 100 / E.stream.size));
+    else
+      snprintf(reading, sizeof(reading), "(reading %.1f MB) ",
+               E.stream.bytes / 1e6);
+  }
+  int len = snprintf(status, sizeof(status), "%.20s - %" PRId64 " lines %s%s",
+                     E.filename                  ? E.filename
+                     : E.curbuf == E.stream_buf ? "[stdin]"
+                                                 : "[No Name]",
+                     E.numrows, reading,
+                     E.follow.on ? (E.pager ? "(paged, following)" : "(following)")
+                     : E.pager   ? "(paged, read-only)"
+                     : E.dirty   ? "(modified)"
+                                 : "");
+  char bufpos[64] = "";
+  int n = 0;
+  if (E.nbuf > 1)
+    n = snprintf(bufpos, sizeof(bufpos), "[%d/%d] ", E.curbuf + 1, E.nbuf);
+  if (E.diff.on && E.diff.nmark)
+    snprintf(&bufpos[n], sizeof(bufpos) - n,
+             "+%" PRId64 " ~%" PRId64 " -%" PRId64 " ", E.diff.added,
+             E.diff.changed, E.diff.deleted);
+  int rlen = snprintf(rstatus, sizeof(rstatus),
+                      "%s%s |  %" PRId64 "/%" PRId64, bufpos,
+                      E.syntax ? E.syntax->filetype : "no ft", E.cy + 1,
+                      E.numrows);
+  if (E.hex) {
+    // offsets and the size instead of lines.
+    len = snprintf(status, sizeof(status), "%.20s - %" PRId64 " bytes %s",
+                   E.filename, (int64_t)E.hex->size,
+                   E.dirty ? "(hex, modified)" : "(hex)");
+    rlen = snprintf(rstatus, sizeof(rstatus),
+                    "%shex |  0x%" PRIx64 "/0x%" PRIx64, bufpos,
+                    (uint64_t)E.hex->cur, (uint64_t)E.hex->size);
+  }
+  if (len > cols)
+    len = cols;
   abAppend(ab, status, len);
-  while (len < E.screencols) {
-    if (E.screencols - len == rlen) {
+  while (len < cols) {
+    if (cols - len == rlen) {
       abAppend(ab, rstatus, rlen);
       break;
     } else {
@@ -1215,18 +6766,23 @@ void editorDrawStatusBar(struct abuf *ab) {
 }
 
 void editorDrawMessageBar(struct abuf *ab) {
+  int cols = editorBarWidth();
   abAppend(ab, "\x1b[K", 3);
 
   int msglen = strlen(E.statusmsg);
-  if (msglen > E.screencols)
-    msglen = E.screencols;
+  if (msglen > cols)
+    msglen = cols;
   if (msglen && time(NULL) - E.statusmsg_time < 5) {
     abAppend(ab, E.statusmsg, msglen);
   }
 }
 
 void editorRefreshScreen() {
+  int64_t start = E.hud.on ? editorNow() : 0;
+  int64_t trace_start = TRACE_BEGIN();
   editorScroll();
+  TRACE_END("scroll", trace_start);
+  diffWork(DIFF_DRAW_BUDGET);
 
   struct abuf ab = ABUF_INIT;
 
@@ -1244,13 +6800,28 @@ void editorRefreshScreen() {
   // This escape sequence is only 3 bytes long, and uses the H command (Cursor
   // Position) to position the cursor.
 
+  trace_start = TRACE_BEGIN();
   editorDrawRows(&ab);
+  if (E.hud.on)
+    editorDrawHud(&ab);
   editorDrawStatusBar(&ab);
   editorDrawMessageBar(&ab);
+  TRACE_END("draw", trace_start);
 
   char buf[32];
-  snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1,
-           (E.rx - E.coloff) + 1);
+  int y, x;
+  if (E.hex) {
+    hexCursor(&y, &x);
+  } else {
+    y = editorScreenY();
+    size_t start = E.coloff;
+    if (E.softwrap)
+      editorCursorSegment(&start);
+    x = E.rx - start;
+    if (E.diff.on)
+      x += DIFF_GUTTER;
+  }
+  snprintf(buf, sizeof(buf), "\x1b[%d;%dH", y + 1, x + 1);
   // the snprintf() function is used to print a formatted string to a buffer.
   // the \x1b is the escape character, and the [ is the left bracket character.
   // the %d is a placeholder for a number.
@@ -1266,18 +6837,38 @@ void editorRefreshScreen() {
   // arguments: the row number and the column number at which to position the
   // cursor.
 
-  write(STDOUT_FILENO, ab.b, ab.len);
+  int64_t built = E.hud.on ? editorNow() : 0;
+  trace_start = TRACE_BEGIN();
+  write(E.outfd, ab.b, ab.len);
+  TRACE_END("write", trace_start);
+  if (E.hud.on) {
+    int64_t now = editorNow();
+    E.hud.build = built - start;
+    E.hud.write = now - built;
+    E.hud.bytes = ab.len;
+    E.hud.hl_time = 0;
+    if (E.hud.key_time) {
+      E.hud.latency = now - E.hud.key_time;
+      E.hud.key_time = 0;
+    }
+  }
+  if (E.replay)
+    editorReplayFrame(ab.len);
   abFree(&ab);
 }
 
 /** init */
 
-void initEditor() {
+// editorInitState() resets everything in E that does not need a terminal,
+// so headless tools like bench.c can set up an editor too.
+void editorInitState() {
   E.cx = 0;
   E.cy = 0;
   E.rx = 0;
   E.rowoff = 0;
   E.coloff = 0;
+  E.softwrap = 0;
+  E.wrapoff = 0;
   E.numrows = 0;
   E.row = NULL;
   E.dirty = 0;
@@ -1285,6 +6876,18 @@ void initEditor() {
   E.statusmsg[0] = '\0';
   E.statusmsg_time = 0;
   E.syntax = NULL;
+  E.pager = NULL;
+  E.hex = NULL;
+  E.match_row = -1;
+  E.hl_stop = -1;
+  E.sym.buf = -1;
+  E.outfd = STDOUT_FILENO;
+  E.stream.fd = -1;
+  E.stream_buf = -1;
+}
+
+void initEditor() {
+  editorInitState();
 
   if (getWindowsSize(&E.screenrows, &E.screencols) == -1)
     die("getWindowSize");
@@ -1294,17 +6897,477 @@ void initEditor() {
 
 // initEditor()’s job will be to initialize all the fields in the E struct.
 
-int main(int argc, char *argv[]) {
+void editorShowHelp() {
+  editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = %s | Ctrl-F = find%s",
+                         E.session ? "detach" : "quit",
+                         E.nbuf > 1 ? " | Ctrl-N/B = next/prev file" : "");
+}
+
+/*** server */
+
+// `./main --server` keeps buffers in memory after the editor is closed, so
+// opening the same file again does not read and highlight it again. the
+// server listens on a Unix socket; `./main --client file` connects to it,
+// starting one when there is none, and sends the terminal size and the
+// files to open. from then on the client only copies keys to the socket and
+// the frames the server draws back to the terminal. the server dup2()s the
+// socket onto stdin and stdout, so the rest of the editor does not know the
+// difference. one client is served at a time, others are turned away and
+// run the editor themselves. Ctrl-Q detaches and leaves everything, unsaved
+// changes too, in the server for next time.
+
+// editorSocketPath() returns where the server listens.
+char *editorSocketPath() {
+  static char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+  char *dir = getenv("XDG_RUNTIME_DIR");
+  int n = dir && *dir
+              ? snprintf(path, sizeof(path), "%s/text_editor.sock", dir)
+              : snprintf(path, sizeof(path), "/tmp/text_editor-%d.sock",
+                         (int)getuid());
+  return n < (int)sizeof(path) ? path : NULL;
+}
+
+int editorSocketAddr(struct sockaddr_un *addr) {
+  char *path = editorSocketPath();
+  if (path == NULL)
+    return -1;
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  strcpy(addr->sun_path, path);
+  return 0;
+}
+
+// editorConnect() returns a socket connected to the server, or -1 when no
+// server of ours is running.
+int editorConnect() {
+  struct sockaddr_un addr;
+  struct stat sb;
+  if (editorSocketAddr(&addr) == -1 || lstat(addr.sun_path, &sb) == -1 ||
+      sb.st_uid != getuid())
+    return -1;
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    return -1;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// editorReadLineFd() reads a line of at most size - 1 bytes from fd, a byte
+// at a time so that nothing after it is consumed.
+int editorReadLineFd(int fd, char *buf, size_t size) {
+  size_t n = 0;
+  while (n < size - 1) {
+    if (read(fd, &buf[n], 1) != 1)
+      return -1;
+    if (buf[n] == '\n') {
+      buf[n] = '\0';
+      return 0;
+    }
+    n++;
+  }
+  return -1;
+}
+
+void editorDetach() {
+  longjmp(E.detach, 1);
+}
+
+// editorBufferFor() returns the buffer of filename, adding one that is read
+// when it is switched to if there is none. the first file a server gets is
+// read into E right away, which has no buffer before that.
+int editorBufferFor(char *filename) {
+  for (int i = 0; i < E.nbuf; i++) {
+    char *f = i == E.curbuf ? E.filename : E.buf[i].filename;
+    if (f && strcmp(f, filename) == 0)
+      return i;
+  }
+  E.buf = realloc(E.buf, (E.nbuf + 1) * sizeof(struct editorBuffer));
+  if (E.buf == NULL)
+    die("realloc");
+  struct editorBuffer *b = &E.buf[E.nbuf];
+  memset(b, 0, sizeof(*b));
+  b->match_row = -1;
+  b->stream.fd = -1;
+  if (E.nbuf == 0) {
+    b->loaded = 1;
+    b->used = ++E.buftick;
+    E.curbuf = 0;
+    E.nbuf = 1;
+    editorOpen(filename);
+    editorWatch();
+    return 0;
+  }
+  b->filename = strdup(filename);
+  return E.nbuf++;
+}
+
+// editorSession() shows files to the attached client until it detaches.
+void editorSession(char **files, int n) {
+  E.session = 1;
+  E.statusmsg[0] = '\0';
+  if (setjmp(E.detach) == 0) {
+    int first = -1;
+    for (int i = 0; i < n; i++) {
+      int b = editorBufferFor(files[i]);
+      if (first == -1)
+        first = b;
+    }
+    if (first != -1 && first != E.curbuf)
+      editorSwitchBuffer(first);
+    else
+      editorCheckDisk();
+    // the file may have changed while no one was attached.
+    if (E.statusmsg[0] == '\0')
+      editorShowHelp();
+    // unless a file could not be opened, which the client should see.
+    while (1) {
+      editorRefreshScreen();
+      editorProcessKeypress();
+    }
+  }
+  E.session = 0;
+  E.checking_disk = 0;
+  E.prompting = 0;
+  // a prompt that was cut short by the detach does not get to reset these.
+}
+
+// editorServeClient() runs one session for the client on fd.
+void editorServeClient(int fd) {
+  char line[PATH_MAX + 1];
+  int rows, cols, n = 0;
+  char **files = NULL;
+  struct timeval tv = {2, 0};
+  // a client that does not say what it wants does not hold up the server.
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  if (editorReadLineFd(fd, line, sizeof(line)) == -1)
+    goto done;
+
+  if (strcmp(line, "stop") == 0) {
+    if (editorAnyDirty()) {
+      write(fd, "D", 1);
+      goto done;
+    }
+    write(fd, "K", 1);
+    unlink(editorSocketPath());
+    exit(0);
+  }
+  if (sscanf(line, "open %d %d %d", &rows, &cols, &n) != 3 || rows < 3 ||
+      cols < 1 || n < 0)
+    goto done;
+  files = calloc(n + 1, sizeof(char *));
+  if (files == NULL)
+    die("calloc");
+  for (int i = 0; i < n; i++) {
+    if (editorReadLineFd(fd, line, sizeof(line)) == -1)
+      goto done;
+    files[i] = strdup(line);
+  }
+
+  // reads now time out like the terminal's do, see enableRawMode().
+  tv.tv_sec = 0;
+  tv.tv_usec = 100000;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  if (write(fd, "K", 1) != 1)
+    goto done;
+  dup2(fd, STDIN_FILENO);
+  dup2(fd, STDOUT_FILENO);
+  E.screenrows = rows - 2;
+  E.screencols = cols - (E.diff.on ? DIFF_GUTTER : 0);
+  editorSession(files, n);
+  int null = open("/dev/null", O_RDWR);
+  dup2(null, STDIN_FILENO);
+  dup2(null, STDOUT_FILENO);
+  close(null);
+
+done:
+  for (int i = 0; files && i < n; i++)
+    free(files[i]);
+  free(files);
+  close(fd);
+}
+
+// editorServerIdle() turns away clients that connect while another one is
+// attached.
+void editorServerIdle() {
+  int fd;
+  while (E.server_fd > 0 &&
+         (fd = accept4(E.server_fd, NULL, NULL, SOCK_CLOEXEC)) != -1) {
+    write(fd, "B", 1);
+    close(fd);
+  }
+}
+
+// editorServe() starts a server in the background. it returns in the
+// process that started it, with 0 once the server is listening.
+int editorServe() {
+  struct sockaddr_un addr;
+  if (editorSocketAddr(&addr) == -1) {
+    fprintf(stderr, "socket path too long\n");
+    return 1;
+  }
+  int fd = editorConnect();
+  if (fd != -1) {
+    close(fd);
+    fprintf(stderr, "a server is already running on %s\n", addr.sun_path);
+    return 1;
+  }
+  unlink(addr.sun_path);
+  // what is left of a server that did not stop cleanly.
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  mode_t mask = umask(077);
+  int bound = fd != -1 && bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+  umask(mask);
+  if (!bound || listen(fd, 8) == -1) {
+    perror(addr.sun_path);
+    return 1;
+  }
+
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    return 1;
+  }
+  if (pid > 0) {
+    close(fd);
+    return 0;
+  }
+  setsid();
+  chdir("/");
+  int null = open("/dev/null", O_RDWR);
+  dup2(null, STDIN_FILENO);
+  dup2(null, STDOUT_FILENO);
+  dup2(null, STDERR_FILENO);
+  close(null);
+  signal(SIGPIPE, SIG_IGN);
+  // a client that goes away mid-frame must not take the server with it.
+
+  editorInitState();
+  E.server_fd = fd;
+  while (1) {
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    poll(&pfd, 1, -1);
+    int client = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+    if (client != -1)
+      editorServeClient(client);
+  }
+}
+
+// editorStopServer() asks the server to exit, which it only does when no
+// buffer has unsaved changes.
+int editorStopServer() {
+  char c = 0;
+  int fd = editorConnect();
+  if (fd == -1) {
+    fprintf(stderr, "no server is running\n");
+    return 1;
+  }
+  if (write(fd, "stop\n", 5) != 5 || read(fd, &c, 1) != 1 || c != 'K') {
+    fprintf(stderr, c == 'D' ? "the server has unsaved changes, attach and "
+                               "save them first\n"
+                             : "the server did not stop\n");
+    close(fd);
+    return 1;
+  }
+  close(fd);
+  return 0;
+}
+
+// editorClient() shows files through the server, starting one if needed.
+// it returns -1 without touching the terminal when there is no server to
+// use, and the editor runs in this process instead.
+int editorClient(char **files, int nfiles) {
+  int rows, cols;
+  if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO) ||
+      getWindowsSize(&rows, &cols) == -1)
+    return -1;
+  for (int i = 0; i < nfiles; i++) {
+    if (strcmp(files[i], "-") == 0)
+      return -1;
+  }
+
+  int fd = editorConnect();
+  if (fd == -1) {
+    pid_t pid = fork();
+    if (pid == 0)
+      _exit(editorServe());
+    int status;
+    if (pid == -1 || waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0 || (fd = editorConnect()) == -1)
+      return -1;
+  }
+
+  // the server has another working directory, it gets absolute paths.
+  struct abuf ab = ABUF_INIT;
+  char cwd[PATH_MAX], line[64];
+  if (getcwd(cwd, sizeof(cwd)) == NULL)
+    cwd[0] = '\0';
+  snprintf(line, sizeof(line), "open %d %d %d\n", rows, cols, nfiles);
+  abAppend(&ab, line, strlen(line));
+  for (int i = 0; i < nfiles; i++) {
+    char *real = realpath(files[i], NULL);
+    if (real) {
+      abAppend(&ab, real, strlen(real));
+      free(real);
+    } else {
+      // a new file, whose directory is where it is relative to.
+      if (files[i][0] != '/') {
+        abAppend(&ab, cwd, strlen(cwd));
+        abAppend(&ab, "/", 1);
+      }
+      abAppend(&ab, files[i], strlen(files[i]));
+    }
+    abAppend(&ab, "\n", 1);
+  }
+  char c = 0;
+  int ok = writeAll(fd, ab.b, ab.len) == 0 && read(fd, &c, 1) == 1 && c == 'K';
+  abFree(&ab);
+  if (!ok) {
+    close(fd);
+    return -1;
+  }
+
   enableRawMode();
-  initEditor();
-  if (argc >= 2) {
-    editorOpen(argv[1]);
+  char buf[65536];
+  struct pollfd fds[2] = {{.fd = STDIN_FILENO, .events = POLLIN},
+                          {.fd = fd, .events = POLLIN}};
+  while (1) {
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (fds[0].revents) {
+      ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+      if (n <= 0 && (fds[0].revents & (POLLHUP | POLLERR)))
+        break;
+      if (n > 0 && writeAll(fd, buf, n) == -1)
+        break;
+    }
+    if (fds[1].revents) {
+      ssize_t n = read(fd, buf, sizeof(buf));
+      if (n <= 0 || writeAll(STDOUT_FILENO, buf, n) == -1)
+        break;
+    }
+  }
+  close(fd);
+  return 0;
+}
+
+#ifndef TEXT_EDITOR_NO_MAIN
+// bench.c includes this file with TEXT_EDITOR_NO_MAIN defined so it can call
+// the editor functions directly.
+int main(int argc, char *argv[]) {
+  char **files = malloc(argc * sizeof(char *));
+  int nfiles = 0;
+  size_t cache_mb = TEXT_EDITOR_CACHE_MB;
+  char *record = NULL, *replay = NULL;
+  int follow = 0, hex = 0, server = 0, client = 0;
+  int64_t max_lines = 0;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--record") && i + 1 < argc)
+      record = argv[++i];
+    else if (!strcmp(argv[i], "--replay") && i + 1 < argc)
+      replay = argv[++i];
+    else if (!strcmp(argv[i], "--trace") && i + 1 < argc)
+      traceStart(argv[++i]);
+    else if (!strcmp(argv[i], "--cache-mb") && i + 1 < argc)
+      cache_mb = strtoul(argv[++i], NULL, 10);
+    else if (!strcmp(argv[i], "--follow"))
+      follow = 1;
+    else if (!strcmp(argv[i], "--hex"))
+      hex = 1;
+    else if (!strcmp(argv[i], "--max-lines") && i + 1 < argc)
+      max_lines = strtoll(argv[++i], NULL, 10);
+    else if (!strcmp(argv[i], "--server"))
+      server = 1;
+    else if (!strcmp(argv[i], "--client"))
+      client = 1;
+    else if (!strcmp(argv[i], "--stop-server"))
+      return editorStopServer();
+    else
+      files[nfiles++] = argv[i];
+  }
+  E.cache_cap = cache_mb * 1024 * 1024;
+  if (server)
+    return editorServe();
+  if (client && !replay && editorClient(files, nfiles) == 0)
+    return 0;
+  if (nfiles == 0 && !replay && !isatty(STDIN_FILENO))
+    files[nfiles++] = "-";
+  // `journalctl | ./main` reads the pipe like `./main -` does.
+  int stream = -1, stream_fd = -1;
+  for (int i = 0; i < nfiles && !replay; i++) {
+    if (strcmp(files[i], "-") == 0 && !isatty(STDIN_FILENO)) {
+      stream = i;
+      stream_fd = editorStreamTty();
+      break;
+    }
+  }
+
+  if (replay) {
+    // replays draw to the terminal when there is one, otherwise frames are
+    // thrown away and an 80x24 screen is assumed.
+    editorInitState();
+    editorReplayOpen(replay);
+    if (!isatty(STDOUT_FILENO) ||
+        getWindowsSize(&E.screenrows, &E.screencols) == -1) {
+      E.outfd = open("/dev/null", O_WRONLY);
+      E.screenrows = 24;
+      E.screencols = 80;
+    }
+    E.screenrows -= 2;
+    atexit(editorReplayReport);
+  } else {
+    enableRawMode();
+    initEditor();
+  }
+  if (record) {
+    E.record = fopen(record, "w");
+    if (E.record == NULL)
+      die("record");
+    setvbuf(E.record, NULL, _IOLBF, 0);
+    E.record_start = editorNow();
+  }
+  E.follow_max = max_lines;
+  if (nfiles) {
+    // only the first file is read now, the others when switched to.
+    E.nbuf = nfiles;
+    E.buf = calloc(nfiles, sizeof(struct editorBuffer));
+    if (E.buf == NULL)
+      die("calloc");
+    for (int i = 1; i < nfiles; i++) {
+      E.buf[i].match_row = -1;
+      E.buf[i].stream.fd = -1;
+      if (strcmp(files[i], "-") == 0)
+        E.buf[i].loaded = 1;
+      else
+        E.buf[i].filename = strdup(files[i]);
+    }
+    E.buf[0].loaded = 1;
+    E.buf[0].used = ++E.buftick;
+    if (strcmp(files[0], "-") != 0)
+      editorOpen(files[0]);
+    // "-" is an empty buffer when stdin is a terminal.
+    editorWatch();
+    if (hex && E.hex == NULL)
+      editorToggleHex();
+    if (follow)
+      editorToggleFollow();
+  }
+  free(files);
+  if (stream != -1) {
+    editorStreamOpen(stream ? &E.buf[stream].stream : &E.stream, stream_fd);
+    E.stream_buf = stream;
   }
 
-  editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find");
+  editorShowHelp();
   while (1) {
     editorRefreshScreen();
     editorProcessKeypress();
   };
   return 0;
 }
+#endif